@@ -0,0 +1,414 @@
+#include "analyzer.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr std::uint16_t START = 0x200;
+
+enum class Flow {
+	Next,      // falls through to the next instruction
+	Skip,      // may also skip the next instruction
+	Jump,      // continues only at the target
+	Call,      // continues at the target and, after return, the next instruction
+	Computed,  // Bnnn, target depends on a register
+	Stop       // 00EE or 00FD, nothing follows statically
+};
+
+Flow classify(std::uint16_t opcode) {
+	std::uint16_t kk = opcode & 0x00FF;
+	switch (opcode & 0xF000) {
+	case 0x0000:
+		return (opcode == 0x00EE || opcode == 0x00FD) ? Flow::Stop : Flow::Next;
+	case 0x1000:
+		return Flow::Jump;
+	case 0x2000:
+		return Flow::Call;
+	case 0x3000:
+	case 0x4000:
+	case 0x9000:
+		return Flow::Skip;
+	case 0x5000:
+		return (opcode & 0x000F) == 0 ? Flow::Skip : Flow::Next;
+	case 0xB000:
+		return Flow::Computed;
+	case 0xE000:
+		return (kk == 0x9E || kk == 0xA1) ? Flow::Skip : Flow::Next;
+	default:
+		return Flow::Next;
+	}
+}
+
+// F000 nnnn is the only instruction that is four bytes long
+int length(std::uint16_t opcode) {
+	return opcode == 0xF000 ? 4 : 2;
+}
+
+void note_usage(std::uint16_t opcode, RomAnalysis& analysis) {
+	std::uint16_t n = opcode & 0x000F;
+	std::uint16_t kk = opcode & 0x00FF;
+	switch (opcode & 0xF000) {
+	case 0x0000:
+		if ((opcode & 0xFFF0) == 0x00C0 || (opcode >= 0x00FB && opcode <= 0x00FF)) {
+			analysis.uses_superchip = true;
+		}
+		if ((opcode & 0xFFF0) == 0x00D0) {
+			analysis.uses_xochip = true;
+		}
+		break;
+	case 0x5000:
+		if (n == 2 || n == 3) {
+			analysis.uses_xochip = true;
+		}
+		break;
+	case 0x8000:
+		if (n == 0x6 || n == 0xE) {
+			analysis.uses_shift = true;
+		}
+		if (n >= 0x1 && n <= 0x3) {
+			analysis.uses_logic = true;
+		}
+		break;
+	case 0xB000:
+		analysis.uses_jump_offset = true;
+		break;
+	case 0xD000:
+		if (n == 0) {
+			analysis.uses_superchip = true;
+		}
+		break;
+	case 0xF000:
+		if (kk == 0x55 || kk == 0x65) {
+			analysis.uses_load_store = true;
+		}
+		if (kk == 0x1E) {
+			analysis.uses_index_add = true;
+		}
+		if (kk == 0x30 || kk == 0x75 || kk == 0x85) {
+			analysis.uses_superchip = true;
+		}
+		if (opcode == 0xF000 || opcode == 0xF002 || kk == 0x01 || kk == 0x3A) {
+			analysis.uses_xochip = true;
+		}
+		break;
+	}
+}
+}
+
+bool is_timer_loop(std::uint16_t address, std::uint16_t first, std::uint16_t second, std::uint16_t third) {
+	// 1nnn only reaches the first 4 KB, a wait past it cannot jump back
+	if (address > 0x0FFF) {
+		return false;
+	}
+	std::uint16_t x = first & 0x0F00;
+	return (first & 0xF0FF) == 0xF007 && second == (0x3000 | x) && third == (0x1000 | address);
+}
+
+RomAnalysis analyze_rom(const std::uint8_t* rom, std::size_t size) {
+	RomAnalysis analysis;
+	analyze_rom(rom, size, analysis);
+	return analysis;
+}
+
+void analyze_rom(const std::uint8_t* rom, std::size_t size, RomAnalysis& analysis) {
+	// everything is reset in place, the vectors keep what they have grown to
+	analysis.code.reset();
+	analysis.blocks.clear();
+	analysis.computed_jumps = false;
+	analysis.uses_shift = false;
+	analysis.uses_load_store = false;
+	analysis.uses_jump_offset = false;
+	analysis.uses_logic = false;
+	analysis.uses_index_add = false;
+	analysis.uses_superchip = false;
+	analysis.uses_xochip = false;
+	analysis.timer_loops.clear();
+	analysis.halt_loops.clear();
+	analysis.self_modifying.clear();
+	std::size_t end = std::min<std::size_t>(START + size, 65536);
+	auto fetch = [&](std::size_t address) -> std::uint16_t {
+		if (address < START || address + 1 >= end) {
+			return 0;
+		}
+		return rom[address - START] << 8 | rom[address - START + 1];
+	};
+	auto in_rom = [&](std::size_t address) {
+		return address >= START && address + 1 < end;
+	};
+
+	// walk every reachable instruction, remembering where blocks must start
+	std::bitset<65536> leaders;
+	std::vector<std::uint16_t>& work = analysis.work;
+	work.clear();
+	if (in_rom(START)) {
+		work.push_back(START);
+		leaders.set(START);
+	}
+	auto follow = [&](std::size_t target, bool leader) {
+		if (!in_rom(target)) {
+			return;
+		}
+		if (leader) {
+			leaders.set(target);
+		}
+		if (!analysis.code[target]) {
+			work.push_back(target);
+		}
+	};
+	while (!work.empty()) {
+		std::uint16_t address = work.back();
+		work.pop_back();
+		if (analysis.code[address]) {
+			continue;
+		}
+		std::uint16_t opcode = fetch(address);
+		analysis.code.set(address);
+		analysis.code.set(address + 1);
+		note_usage(opcode, analysis);
+
+		std::uint16_t next = address + length(opcode);
+		std::uint16_t nnn = opcode & 0x0FFF;
+		switch (classify(opcode)) {
+		case Flow::Next:
+			follow(next, false);
+			break;
+		case Flow::Skip:
+			follow(next, true);
+			follow(next + length(fetch(next)), true);
+			break;
+		case Flow::Jump:
+			if (nnn == address) {
+				analysis.halt_loops.push_back(address);
+			}
+			follow(nnn, true);
+			break;
+		case Flow::Call:
+			follow(nnn, true);
+			follow(next, true);
+			break;
+		case Flow::Computed:
+			// V0 is often zero, the rest of the table is unknown
+			analysis.computed_jumps = true;
+			follow(nnn, true);
+			break;
+		case Flow::Stop:
+			break;
+		}
+	}
+
+	// cut the reached code into blocks at every leader and control transfer
+	for (std::size_t address = START; address < end; address++) {
+		if (!leaders[address]) {
+			continue;
+		}
+		BasicBlock block;
+		block.start = address;
+		block.successor_count = 0;
+		std::uint16_t at = address;
+		for (;;) {
+			std::uint16_t opcode = fetch(at);
+			std::uint16_t next = at + length(opcode);
+			Flow flow = classify(opcode);
+			if (flow != Flow::Next || !in_rom(next) || leaders[next] || !analysis.code[next]) {
+				block.end = next;
+				std::uint16_t nnn = opcode & 0x0FFF;
+				switch (flow) {
+				case Flow::Next:
+					if (in_rom(next)) {
+						block.successors[block.successor_count++] = next;
+					}
+					break;
+				case Flow::Skip:
+					block.successors[block.successor_count++] = next;
+					block.successors[block.successor_count++] = next + length(fetch(next));
+					break;
+				case Flow::Jump:
+				case Flow::Computed:
+					block.successors[block.successor_count++] = nnn;
+					break;
+				case Flow::Call:
+					block.successors[block.successor_count++] = nnn;
+					block.successors[block.successor_count++] = next;
+					break;
+				case Flow::Stop:
+					break;
+				}
+				break;
+			}
+			at = next;
+		}
+		analysis.blocks.push_back(block);
+	}
+
+	// a constant I from Annn followed by Fx33/Fx55 in the same block is a
+	// write to a known address, flag it when it lands on reached code
+	for (const BasicBlock& block : analysis.blocks) {
+		int index = -1;
+		for (std::uint16_t at = block.start; at < block.end; at += length(fetch(at))) {
+			std::uint16_t opcode = fetch(at);
+			std::uint16_t x = (opcode & 0x0F00) >> 8;
+			if ((opcode & 0xF000) == 0xA000) {
+				index = opcode & 0x0FFF;
+			}
+			else if (opcode == 0xF000) {
+				index = fetch(at + 2);
+			}
+			else if ((opcode & 0xF0FF) == 0xF01E || (opcode & 0xF0FF) == 0xF029 ||
+				(opcode & 0xF0FF) == 0xF030) {
+				index = -1;
+			}
+			else if (index >= 0 && ((opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055)) {
+				int last = index + ((opcode & 0xF0FF) == 0xF033 ? 2 : x);
+				for (int written = index; written <= last && written < 65536; written++) {
+					if (analysis.code[written]) {
+						analysis.self_modifying.push_back(MemoryRange{ static_cast<std::uint16_t>(index), static_cast<std::uint16_t>(last + 1) });
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// timer waits whose bytes nothing is known to overwrite
+	for (std::size_t address = START; address + 5 < end; address += 2) {
+		if (!analysis.code[address] || !is_timer_loop(address, fetch(address), fetch(address + 2), fetch(address + 4))) {
+			continue;
+		}
+		bool modified = false;
+		for (const MemoryRange& range : analysis.self_modifying) {
+			modified |= range.start < address + 6 && address < range.end;
+		}
+		if (!modified) {
+			analysis.timer_loops.push_back(address);
+		}
+	}
+}
+
+QuirkProfile suggest_quirk_profile(const RomAnalysis& analysis) {
+	if (analysis.uses_xochip) {
+		return QuirkProfile::XoChip;
+	}
+	if (analysis.uses_superchip) {
+		return QuirkProfile::SuperChip;
+	}
+	return QuirkProfile::Legacy;
+}
+
+std::string disassemble(std::uint16_t opcode) {
+	char text[32];
+	unsigned x = (opcode & 0x0F00) >> 8;
+	unsigned y = (opcode & 0x00F0) >> 4;
+	unsigned n = opcode & 0x000F;
+	unsigned kk = opcode & 0x00FF;
+	unsigned nnn = opcode & 0x0FFF;
+	switch (opcode & 0xF000) {
+	case 0x0000:
+		if (opcode == 0x00E0) return "CLS";
+		if (opcode == 0x00EE) return "RET";
+		if (opcode == 0x00FB) return "SCR";
+		if (opcode == 0x00FC) return "SCL";
+		if (opcode == 0x00FD) return "EXIT";
+		if (opcode == 0x00FE) return "LOW";
+		if (opcode == 0x00FF) return "HIGH";
+		if ((opcode & 0xFFF0) == 0x00C0) {
+			snprintf(text, sizeof(text), "SCD %u", n);
+			return text;
+		}
+		if ((opcode & 0xFFF0) == 0x00D0) {
+			snprintf(text, sizeof(text), "SCU %u", n);
+			return text;
+		}
+		break;
+	case 0x1000:
+		snprintf(text, sizeof(text), "JP 0x%03X", nnn);
+		return text;
+	case 0x2000:
+		snprintf(text, sizeof(text), "CALL 0x%03X", nnn);
+		return text;
+	case 0x3000:
+		snprintf(text, sizeof(text), "SE V%X, 0x%02X", x, kk);
+		return text;
+	case 0x4000:
+		snprintf(text, sizeof(text), "SNE V%X, 0x%02X", x, kk);
+		return text;
+	case 0x5000:
+		if (n == 0) {
+			snprintf(text, sizeof(text), "SE V%X, V%X", x, y);
+			return text;
+		}
+		if (n == 2 || n == 3) {
+			snprintf(text, sizeof(text), "%s V%X - V%X", n == 2 ? "SAVE" : "LOAD", x, y);
+			return text;
+		}
+		break;
+	case 0x6000:
+		snprintf(text, sizeof(text), "LD V%X, 0x%02X", x, kk);
+		return text;
+	case 0x7000:
+		snprintf(text, sizeof(text), "ADD V%X, 0x%02X", x, kk);
+		return text;
+	case 0x8000: {
+		static const char* names[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+			nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL", nullptr };
+		if (names[n] != nullptr) {
+			snprintf(text, sizeof(text), "%s V%X, V%X", names[n], x, y);
+			return text;
+		}
+		break;
+	}
+	case 0x9000:
+		if (n == 0) {
+			snprintf(text, sizeof(text), "SNE V%X, V%X", x, y);
+			return text;
+		}
+		break;
+	case 0xA000:
+		snprintf(text, sizeof(text), "LD I, 0x%03X", nnn);
+		return text;
+	case 0xB000:
+		snprintf(text, sizeof(text), "JP V0, 0x%03X", nnn);
+		return text;
+	case 0xC000:
+		snprintf(text, sizeof(text), "RND V%X, 0x%02X", x, kk);
+		return text;
+	case 0xD000:
+		snprintf(text, sizeof(text), "DRW V%X, V%X, %u", x, y, n);
+		return text;
+	case 0xE000:
+		if (kk == 0x9E || kk == 0xA1) {
+			snprintf(text, sizeof(text), "%s V%X", kk == 0x9E ? "SKP" : "SKNP", x);
+			return text;
+		}
+		break;
+	case 0xF000: {
+		const char* format = nullptr;
+		switch (kk) {
+		case 0x00: if (x == 0) return "LD I, LONG"; break;
+		case 0x01: format = "PLANE %X"; break;
+		case 0x02: if (x == 0) return "AUDIO"; break;
+		case 0x07: format = "LD V%X, DT"; break;
+		case 0x0A: format = "LD V%X, K"; break;
+		case 0x15: format = "LD DT, V%X"; break;
+		case 0x18: format = "LD ST, V%X"; break;
+		case 0x1E: format = "ADD I, V%X"; break;
+		case 0x29: format = "LD F, V%X"; break;
+		case 0x30: format = "LD HF, V%X"; break;
+		case 0x33: format = "LD B, V%X"; break;
+		case 0x3A: format = "PITCH V%X"; break;
+		case 0x55: format = "LD [I], V%X"; break;
+		case 0x65: format = "LD V%X, [I]"; break;
+		case 0x75: format = "LD R, V%X"; break;
+		case 0x85: format = "LD V%X, R"; break;
+		}
+		if (format != nullptr) {
+			snprintf(text, sizeof(text), format, x);
+			return text;
+		}
+		break;
+	}
+	}
+	snprintf(text, sizeof(text), "DW 0x%04X", opcode);
+	return text;
+}
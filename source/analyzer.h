@@ -0,0 +1,56 @@
+#ifndef ANALYZER
+#define ANALYZER
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+// straight line run of instructions, control only enters at start
+struct BasicBlock {
+	std::uint16_t start;
+	std::uint16_t end;                       // one past the last instruction byte
+	std::array<std::uint16_t, 2> successors; // blocks control may continue in
+	int successor_count;
+};
+
+// address range [start, end) written by Fx33/Fx55 that also holds code
+struct MemoryRange {
+	std::uint16_t start;
+	std::uint16_t end;
+};
+
+// what can be learned about a rom without running it, by following every
+// path from 0x200 through jumps, calls, returns and skips
+struct RomAnalysis {
+	std::bitset<65536> code;                 // bytes reached as instructions
+	std::vector<BasicBlock> blocks;          // sorted by start address
+	bool computed_jumps = false;             // Bnnn seen, the graph may be incomplete
+
+	// quirk sensitive instructions the rom uses
+	bool uses_shift = false;                 // 8xy6, 8xyE
+	bool uses_load_store = false;            // Fx55, Fx65
+	bool uses_jump_offset = false;           // Bnnn
+	bool uses_logic = false;                 // 8xy1, 8xy2, 8xy3
+	bool uses_index_add = false;             // Fx1E
+	bool uses_superchip = false;             // 00Cn, 00FB-00FF, Dxy0, Fx30, Fx75, Fx85
+	bool uses_xochip = false;                // 5xy2, 5xy3, F000, Fn01, F002, Fx3A, 00Dn
+
+	std::vector<std::uint16_t> timer_loops;  // Fx07 of "Fx07, 3x00, jump back" waits
+	std::vector<std::uint16_t> halt_loops;   // jumps to themselves
+	std::vector<MemoryRange> self_modifying;
+
+	std::vector<std::uint16_t> work;         // addresses still to walk, kept for reuse
+};
+
+RomAnalysis analyze_rom(const std::uint8_t* rom, std::size_t size);
+// the same into an analysis of an earlier rom, whose vectors are reused so
+// analyzing rom after rom stops allocating once they have grown
+void analyze_rom(const std::uint8_t* rom, std::size_t size, RomAnalysis& analysis);
+QuirkProfile suggest_quirk_profile(const RomAnalysis& analysis);
+bool is_timer_loop(std::uint16_t address, std::uint16_t first, std::uint16_t second, std::uint16_t third);
+std::string disassemble(std::uint16_t opcode);
+#endif
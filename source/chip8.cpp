@@ -1,19 +1,244 @@
 
 #include "chip8.h"
+#include "analyzer.h"
+#include "compiled.h"
+#include "debugger.h"
+#include "hash.h"
+#include "profiler.h"
+#include "romdb.h"
+#include "tracer.h"
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 #include <fstream>
-#include <iostream>
 #include <random>
-#include <vector>
+#include <type_traits>
+
+namespace {
+// 4x5 sprites for the hexadecimal digits followed by the 8x10 super-chip
+// digits, stored at the start of memory
+constexpr int BIG_FONT = 80;
+constexpr std::array<std::uint8_t, 240> fontset = { {
+	0xF0, 0x90, 0x90, 0x90, 0xF0,  // 0
+	0x20, 0x60, 0x20, 0x20, 0x70,  // 1
+	0xF0, 0x10, 0xF0, 0x80, 0xF0,  // 2
+	0xF0, 0x10, 0xF0, 0x10, 0xF0,  // 3
+	0x90, 0x90, 0xF0, 0x10, 0x10,  // 4
+	0xF0, 0x80, 0xF0, 0x10, 0xF0,  // 5
+	0xF0, 0x80, 0xF0, 0x90, 0xF0,  // 6
+	0xF0, 0x10, 0x20, 0x40, 0x40,  // 7
+	0xF0, 0x90, 0xF0, 0x90, 0xF0,  // 8
+	0xF0, 0x90, 0xF0, 0x10, 0xF0,  // 9
+	0xF0, 0x90, 0xF0, 0x90, 0x90,  // A
+	0xE0, 0x90, 0xE0, 0x90, 0xE0,  // B
+	0xF0, 0x80, 0x80, 0x80, 0xF0,  // C
+	0xE0, 0x90, 0x90, 0x90, 0xE0,  // D
+	0xF0, 0x80, 0xF0, 0x80, 0xF0,  // E
+	0xF0, 0x80, 0xF0, 0x80, 0x80,  // F
+	0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C,  // 0
+	0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C,  // 1
+	0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF,  // 2
+	0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C,  // 3
+	0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06,  // 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C,  // 5
+	0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C,  // 6
+	0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60,  // 7
+	0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C,  // 8
+	0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C,  // 9
+	0x18, 0x3C, 0x66, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,  // A
+	0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC,  // B
+	0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C,  // C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,  // D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xFF, 0xFF,  // E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xC0, 0xC0   // F
+} };
+
+// backs every page nothing has written to yet
+alignas(64) const std::array<std::uint8_t, 1024> zero_page = {};
+
+// attached while nothing else is, its hooks compile to nothing
+NullObserver null_observer;
+
+// cosmac vip timing: a frame is 262 display lines of 14 machine cycles, the
+// 128 lines showing the screen go to the display interrupt and dma, and
+// what is left runs the interpreter
+constexpr int VIP_LINE_CYCLES = 14;
+constexpr int VIP_FRAME_CYCLES = VIP_LINE_CYCLES * (262 - 128) - 40;
+constexpr int VIP_FETCH_CYCLES = 40;  // fetch and decode, paid by every instruction
+
+// machine cycles an instruction takes after decoding: a fixed part, a part
+// per unit (sprite row or register moved) and the extra when a skip is
+// taken; averages of the original routines, whose real cost also varies
+// with data such as a sprite's horizontal offset
+struct CycleCost {
+	std::uint16_t base;
+	std::uint16_t per_unit;
+	std::uint16_t skip;
+};
+
+enum CostClass {
+	COST_CLEAR, COST_RETURN, COST_JUMP, COST_CALL, COST_SKIP_IMMEDIATE, COST_SKIP_REGISTER,
+	COST_LOAD, COST_ADD, COST_ALU, COST_INDEX, COST_JUMP_OFFSET, COST_RANDOM, COST_DRAW,
+	COST_SKIP_KEY, COST_READ_TIMER, COST_WAIT_KEY, COST_SET_TIMER, COST_ADD_INDEX, COST_FONT,
+	COST_BCD, COST_LOAD_STORE, COST_OTHER, COST_CLASSES
+};
+
+constexpr std::array<CycleCost, COST_CLASSES> vip_costs = { {
+	{ 3038, 0, 0 },  // 00E0, clears 256 bytes one at a time
+	{ 10, 0, 0 },    // 00EE
+	{ 12, 0, 0 },    // 1nnn
+	{ 26, 0, 0 },    // 2nnn
+	{ 10, 0, 4 },    // 3xkk, 4xkk
+	{ 14, 0, 4 },    // 5xy0, 9xy0
+	{ 6, 0, 0 },     // 6xkk
+	{ 10, 0, 0 },    // 7xkk
+	{ 44, 0, 0 },    // 8xyn, runs a generated 1802 instruction
+	{ 12, 0, 0 },    // Annn
+	{ 22, 0, 0 },    // Bnnn
+	{ 36, 0, 0 },    // Cxkk
+	{ 26, 46, 0 },   // Dxyn, per sprite row
+	{ 14, 0, 4 },    // Ex9E, ExA1
+	{ 10, 0, 0 },    // Fx07
+	{ 19, 0, 0 },    // Fx0A, per poll
+	{ 10, 0, 0 },    // Fx15, Fx18
+	{ 16, 0, 0 },    // Fx1E
+	{ 16, 0, 0 },    // Fx29
+	{ 180, 0, 0 },   // Fx33, repeated subtraction
+	{ 14, 14, 0 },   // Fx55, Fx65, per register
+	{ 20, 0, 0 }     // instructions the vip never had
+} };
+
+CostClass cost_class(std::uint16_t opcode) {
+	std::uint16_t kk = opcode & 0x00FF;
+	switch (opcode & 0xF000) {
+	case 0x0000: return opcode == 0x00E0 ? COST_CLEAR : opcode == 0x00EE ? COST_RETURN : COST_OTHER;
+	case 0x1000: return COST_JUMP;
+	case 0x2000: return COST_CALL;
+	case 0x3000:
+	case 0x4000: return COST_SKIP_IMMEDIATE;
+	case 0x5000:
+	case 0x9000: return (opcode & 0x000F) == 0 ? COST_SKIP_REGISTER : COST_OTHER;
+	case 0x6000: return COST_LOAD;
+	case 0x7000: return COST_ADD;
+	case 0x8000: return COST_ALU;
+	case 0xA000: return COST_INDEX;
+	case 0xB000: return COST_JUMP_OFFSET;
+	case 0xC000: return COST_RANDOM;
+	case 0xD000: return COST_DRAW;
+	case 0xE000: return COST_SKIP_KEY;
+	default:
+		switch (kk) {
+		case 0x07: return COST_READ_TIMER;
+		case 0x0A: return COST_WAIT_KEY;
+		case 0x15:
+		case 0x18: return COST_SET_TIMER;
+		case 0x1E: return COST_ADD_INDEX;
+		case 0x29: return COST_FONT;
+		case 0x33: return COST_BCD;
+		case 0x55:
+		case 0x65: return COST_LOAD_STORE;
+		default: return COST_OTHER;
+		}
+	}
+}
+
+// all ones for the words of a display row that belong to a selected plane
+std::array<std::uint64_t, 4> plane_masks(std::uint8_t planes) {
+	std::uint64_t first = planes & 1 ? ~std::uint64_t(0) : 0;
+	std::uint64_t second = planes & 2 ? ~std::uint64_t(0) : 0;
+	return { { first, first, second, second } };
+}
+
+// settings for a rom from the database when it knows the rom's hash,
+// otherwise from analyzing it, which also finds the loops to skip
+void find_settings(const RomDatabase* database, RomAnalysis* scratch, const std::uint8_t* rom, std::size_t size,
+	RomSettings& settings, std::uint64_t& rom_hash, std::bitset<4096>& idle_loops) {
+	rom_hash = hash_bytes(rom, size);
+	const RomSettings* known = database != nullptr ? database->find(rom_hash) : nullptr;
+	settings = known != nullptr ? *known : RomSettings();
+	idle_loops.reset();
+	if (known == nullptr) {
+		RomAnalysis temporary;
+		RomAnalysis& analysis = scratch != nullptr ? *scratch : temporary;
+		analyze_rom(rom, size, analysis);
+		settings.quirks = suggest_quirk_profile(analysis);
+		// only loops a 1nnn can jump into are ever looked up
+		for (std::uint16_t address : analysis.halt_loops) {
+			if (address < idle_loops.size()) {
+				idle_loops.set(address);
+			}
+		}
+		for (std::uint16_t address : analysis.timer_loops) {
+			if (address < idle_loops.size()) {
+				idle_loops.set(address);
+			}
+		}
+	}
+}
+}
+
+bool SharedRom::load(const std::uint8_t* data, std::size_t size, const RomDatabase* database, RomAnalysis* analysis) {
+	if (size > image.size() - 512) {
+		return false;
+	}
+	image.fill(0);
+	std::copy(fontset.begin(), fontset.end(), image.begin());
+	std::copy(data, data + size, image.begin() + 512);
+	find_settings(database, analysis, data, size, settings, rom_hash, idle_loops);
+	return true;
+}
 
 Chip8::Chip8() {
+	reset_registers();
+	timing = TimingMode::Instructions;
+	frame_instructions = 0;
+	observer = &null_observer;
+	select_fn = &Chip8::select_interpreter<NullObserver>;
+	compiled = nullptr;
+	set_quirk_profile(QuirkProfile::Legacy);
+	database = nullptr;
+	analysis = nullptr;
+	rom_hash = 0;
+	idle_period = 0;
+	reset_memory();
+
+	// initialize random number generator, xorshift32 must not be seeded 0
+	rng = std::random_device()() | 1;
+}
+
+Chip8::Chip8(const SharedRom& rom) {
+	reset_registers();
+	timing = TimingMode::Instructions;
+	frame_instructions = 0;
+	observer = &null_observer;
+	select_fn = &Chip8::select_interpreter<NullObserver>;
+	compiled = nullptr;
+	database = nullptr;
+	analysis = nullptr;
+	idle_period = 0;
+	rng = std::random_device()() | 1;
+
+	// what apply_settings would have set, from the one analysis of the rom
+	settings = rom.settings;
+	rom_hash = rom.rom_hash;
+	idle_loops = rom.idle_loops;
+	timing = settings.instructions_per_frame == 0 ? TimingMode::CosmacVip : TimingMode::Instructions;
+	set_quirk_profile(settings.quirks);
+
+	// every page reads from the shared image, this instance's own memory is
+	// not touched until a page is written so it stays out of the cache
+	for (int i = 0; i < PAGE_COUNT; i++) {
+		pages[i] = rom.image.data() + i * PAGE_SIZE;
+	}
+	shared_pages = ~std::uint64_t(0);
+}
+
+void Chip8::reset_registers() {
 	// program counter must start at memory location 0x200
 	pc = 0x200;
 
-	// the stack, display, memory, and key arrays must be cleared
-	memory.fill(0);
+	// the stack, display, and register arrays must be cleared
 	V.fill(0);
-	keys.fill(0);
 	graphics.fill(0);
 	stack.fill(0);
 
@@ -22,53 +247,281 @@ Chip8::Chip8() {
 	sound_timer = 0;
 	I = 0;
 	sp = 0;
+	keys = 0;
+	cycles = 0;
 
 	// no initial instruction
 	opcode = 0;
 
 	// nothing to draw initially
 	draw_flag = false;
+	hires = false;
+	rpl.fill(0);
 
-	// initialize random number generator
-	gen.seed(rd());
-
-	// load the fontset into memory
-	std::array<std::uint8_t, 80> fontset = { {
-		0xF0, 0x90, 0x90, 0x90, 0xF0,  // 0
-		0x20, 0x60, 0x20, 0x20, 0x70,  // 1
-		0xF0, 0x10, 0xF0, 0x80, 0xF0,  // 2
-		0xF0, 0x10, 0xF0, 0x10, 0xF0,  // 3
-		0x90, 0x90, 0xF0, 0x10, 0x10,  // 4
-		0xF0, 0x80, 0xF0, 0x10, 0xF0,  // 5
-		0xF0, 0x80, 0xF0, 0x90, 0xF0,  // 6
-		0xF0, 0x10, 0x20, 0x40, 0x40,  // 7
-		0xF0, 0x90, 0xF0, 0x90, 0xF0,  // 8
-		0xF0, 0x90, 0xF0, 0x10, 0xF0,  // 9
-		0xF0, 0x90, 0xF0, 0x90, 0x90,  // A
-		0xE0, 0x90, 0xE0, 0x90, 0xE0,  // B
-		0xF0, 0x80, 0x80, 0x80, 0xF0,  // C
-		0xE0, 0x90, 0x90, 0x90, 0xE0,  // D
-		0xF0, 0x80, 0xF0, 0x80, 0xF0,  // E
-		0xF0, 0x80, 0xF0, 0x80, 0x80   // F
-	} };
-	for (int i = 0; i < 80; ++i) {
-		memory[i] = fontset[i];
-	}
-}
-
-void Chip8::load_rom(std::string path) {
+	// xo-chip draws to the first plane and beeps until given a pattern
+	planes = 1;
+	pattern.fill(0);
+	pitch = 64;
+	pattern_set = false;
+
+	timing_credit = 0;
+
+	halt_reason = HaltReason::None;
+	faults.fill(0);
+}
+
+void Chip8::reset_memory() {
+	// only the page holding the fontset is cleared and owned, the rest read
+	// as zero until they are written or a rom is loaded into them, so this is
+	// cheap however much a previous rom wrote
+	std::fill(memory.begin(), memory.begin() + PAGE_SIZE, 0);
+	std::copy(fontset.begin(), fontset.end(), memory.begin());
+	pages[0] = memory.data();
+	for (int i = 1; i < PAGE_COUNT; i++) {
+		pages[i] = zero_page.data();
+	}
+	shared_pages = ~std::uint64_t(1);
+}
+
+std::uint8_t Chip8::read(std::uint16_t address) {
+	address &= memory.size() - 1;
+	return pages[address / PAGE_SIZE][address % PAGE_SIZE];
+}
+
+void Chip8::write(std::uint16_t address, std::uint8_t value) {
+	address &= memory.size() - 1;
+	if (shared_pages >> (address / PAGE_SIZE) & 1) {
+		privatize(address / PAGE_SIZE);
+	}
+	memory[address] = value;
+}
+
+template <typename Observer>
+void Chip8::write_observed(std::uint16_t address, std::uint8_t value) {
+	static_cast<Observer*>(observer)->on_mem_write(address & (memory.size() - 1), value);
+	write(address, value);
+}
+
+void Chip8::privatize(int page) {
+	std::copy(pages[page], pages[page] + PAGE_SIZE, memory.begin() + page * PAGE_SIZE);
+	pages[page] = memory.data() + page * PAGE_SIZE;
+	shared_pages &= ~(std::uint64_t(1) << page);
+}
+
+void Chip8::privatize_range(std::size_t end) {
+	for (std::size_t i = 0; i < PAGE_COUNT && i * PAGE_SIZE < end; i++) {
+		if (shared_pages >> i & 1) {
+			privatize(i);
+		}
+	}
+}
+
+bool Chip8::load_rom(std::string path) {
 	std::ifstream file(path, std::ios::binary | std::ios::ate);
 	std::ifstream::pos_type file_size = file.tellg();
-	std::vector<std::uint8_t> buffer(file_size);
+	if (!file || file_size > static_cast<std::streamoff>(memory.size() - 512)) {
+		return false;
+	}
+	reset_registers();
+	reset_memory();
+	// read straight into ram, first 512 bytes are reserved
+	privatize_range(512 + static_cast<std::size_t>(file_size));
 	file.seekg(0, std::ios::beg);
-	file.read(reinterpret_cast<char*>(buffer.data()), file_size);
-	for (int i = 0; i < file_size; i++) {
-		memory[i + 512] = buffer[i];  // first 512 bytes are reserved
+	if (!file.read(reinterpret_cast<char*>(memory.data() + 512), file_size)) {
+		return false;
+	}
+	apply_settings(file_size);
+	return true;
+}
+
+bool Chip8::load_rom(const std::uint8_t* data, std::size_t size) {
+	if (size > memory.size() - 512) {
+		return false;
+	}
+	reset_registers();
+	reset_memory();
+	privatize_range(512 + size);
+	std::copy(data, data + size, memory.begin() + 512);
+	apply_settings(size);
+	return true;
+}
+
+void Chip8::apply_settings(std::size_t rom_size) {
+	find_settings(database, analysis, memory.data() + 512, rom_size, settings, rom_hash, idle_loops);
+	timing = settings.instructions_per_frame == 0 ? TimingMode::CosmacVip : TimingMode::Instructions;
+	halt_reason = HaltReason::None;
+	compiled = nullptr;
+	set_quirk_profile(settings.quirks);
+}
+
+void Chip8::set_database(const RomDatabase* db) {
+	database = db;
+}
+
+void Chip8::set_analysis(RomAnalysis* scratch) {
+	analysis = scratch;
+}
+
+const RomSettings& Chip8::get_settings() {
+	return settings;
+}
+
+std::uint64_t Chip8::get_rom_hash() {
+	return rom_hash;
+}
+
+void Chip8::set_quirk_profile(QuirkProfile quirks) {
+	profile = quirks;
+	(this->*select_fn)();
+}
+
+template <typename Observer>
+void Chip8::select_interpreter() {
+	switch (profile) {
+	case QuirkProfile::Legacy:
+		use_interpreter<QuirkProfile::Legacy, Observer>();
+		break;
+	case QuirkProfile::CosmacVip:
+		use_interpreter<QuirkProfile::CosmacVip, Observer>();
+		break;
+	case QuirkProfile::Chip48:
+		use_interpreter<QuirkProfile::Chip48, Observer>();
+		break;
+	case QuirkProfile::SuperChip:
+		use_interpreter<QuirkProfile::SuperChip, Observer>();
+		break;
+	case QuirkProfile::XoChip:
+		use_interpreter<QuirkProfile::XoChip, Observer>();
+		break;
+	}
+}
+
+template <QuirkProfile P, typename Observer>
+void Chip8::use_interpreter() {
+	// the timing mode and halting only swap the frame loop, the
+	// instructions are shared
+	cycle_fn = &Chip8::execute<Quirks<P>, Observer>;
+	if (halt_reason != HaltReason::None) {
+		frame_fn = &Chip8::execute_frame_halted;
+	}
+	else if (timing == TimingMode::CosmacVip) {
+		frame_fn = &Chip8::execute_frame_timed<Quirks<P>, Observer>;
+	}
+	else if (std::is_same<Observer, NullObserver>::value && compiled != nullptr && compiled->quirks == P) {
+		frame_fn = &Chip8::execute_frame_compiled<Quirks<P>>;
+	}
+	else {
+		frame_fn = &Chip8::execute_frame<Quirks<P>, Observer>;
+	}
+}
+
+QuirkProfile Chip8::get_quirk_profile() {
+	return profile;
+}
+
+void Chip8::set_timing_mode(TimingMode mode) {
+	timing = mode;
+	set_quirk_profile(profile);
+}
+
+TimingMode Chip8::get_timing_mode() {
+	return timing;
+}
+
+template <typename Observer>
+void Chip8::set_observer(Observer* attached) {
+	observer = attached;
+	select_fn = &Chip8::select_interpreter<Observer>;
+	set_quirk_profile(profile);
+}
+
+void Chip8::clear_observer() {
+	set_observer(&null_observer);
+}
+
+bool Chip8::set_compiled(const CompiledRom* rom) {
+	// translated code reads and writes memory directly, so every page
+	// becomes this instance's own first
+	compiled = nullptr;
+	if (rom != nullptr && rom->quirks == profile) {
+		privatize_range(memory.size());
+		compiled = rom;
+		if (!matches_compiled()) {
+			compiled = nullptr;
+		}
 	}
+	set_quirk_profile(profile);
+	return compiled == rom;
+}
+
+const CompiledRom* Chip8::get_compiled() {
+	return compiled;
+}
+
+bool Chip8::matches_compiled() {
+	// only the bytes the translation depends on have to be as translated
+	for (std::size_t i = 0; i < compiled->image_size && 512 + i < memory.size(); i++) {
+		if (is_translated(*compiled, 512 + i) && memory[512 + i] != compiled->image[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Chip8::writes_compiled(std::uint16_t index) {
+	// the instruction just interpreted, index is I from before it ran
+	std::uint16_t x = (opcode & 0x0F00) >> 8;
+	std::uint16_t y = (opcode & 0x00F0) >> 4;
+	int count = 0;
+	if ((opcode & 0xF00F) == 0x5002) {
+		count = std::abs(x - y) + 1;
+	}
+	else if ((opcode & 0xF0FF) == 0xF033) {
+		count = 3;
+	}
+	else if ((opcode & 0xF0FF) == 0xF055) {
+		count = x + 1;
+	}
+	for (int i = 0; i < count; i++) {
+		if (is_translated(*compiled, index + i)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Chip8::drop_compiled() {
+	compiled = nullptr;
+	(this->*select_fn)();
+}
+
+int Chip8::get_frame_instructions() {
+	return timing == TimingMode::CosmacVip ? frame_instructions : settings.instructions_per_frame;
 }
 
 void Chip8::emulate_cycle() {
-	opcode = memory[pc] << 8 | memory[pc + 1];  // get instruction
+	// a halted machine stays on the instruction that stopped it, as a frame would
+	if (halt_reason != HaltReason::None) {
+		return;
+	}
+	std::uint16_t index = I;
+	(this->*cycle_fn)();
+	idle_period = 0;
+	if (compiled != nullptr && writes_compiled(index)) {
+		drop_compiled();
+	}
+}
+
+void Chip8::run_frame(int instructions, const KeyEvent* events, int event_count) {
+	(this->*frame_fn)(instructions, events, event_count);
+}
+
+template <typename Quirks, typename Observer>
+void Chip8::execute() {
+	Observer& hooks = *static_cast<Observer*>(observer);
+	opcode = read(pc) << 8 | read(pc + 1);  // get instruction
+	cycles++;
+	hooks.on_fetch(pc, opcode, cycles);
 
 	std::uint16_t x = (opcode & 0x0F00) >> 8;  // second 4 bits e.g. 0xA(B)CD
 	std::uint16_t y = (opcode & 0x00F0) >> 4;  // third 4 bits e.g. 0xAB(C)D
@@ -76,44 +529,126 @@ void Chip8::emulate_cycle() {
 	std::uint16_t n = opcode & 0x000F;         // last 4 bits e.g. 0xABC(D)
 
 	switch (opcode & 0xF000) {  // first 4 bits decide the instruction
-	case 0x0000:            // possible instructions are 0x00E0 or 0x00EE
+	case 0x0000:            // possible instructions are 0x00E0, 0x00EE, super-chip 0x00Cn, 0x00FB-0x00FF and xo-chip 0x00Dn
+		if ((opcode & 0xFFF0) == 0x00C0) {  // 0x00Cn, scroll down n rows
+			scroll_down(n);
+			draw_flag = true;
+			pc += 2;
+			break;
+		}
+		if ((opcode & 0xFFF0) == 0x00D0) {  // 0x00Dn, scroll up n rows
+			scroll_up(n);
+			draw_flag = true;
+			pc += 2;
+			break;
+		}
 		switch (opcode) {
-		case 0x00E0:  // clear display
-			graphics.fill(0);
+		case 0x00E0:  // clear the selected planes
+			for (int row = 0; row < 64; row++) {
+				for (int plane = 0; plane < 2; plane++) {
+					if (planes >> plane & 1) {
+						graphics[row * 4 + plane * 2] = 0;
+						graphics[row * 4 + plane * 2 + 1] = 0;
+					}
+				}
+			}
 			draw_flag = true;
 			pc += 2;
 			break;
 		case 0x00EE:  // return from a subroutine
+			if (sp == 0) {
+				halt(HaltReason::StackUnderflow);
+				break;
+			}
 			pc = stack[--sp];
 			pc += 2;
 			break;
+		case 0x00FB:  // scroll right 4 pixels
+			scroll_right();
+			draw_flag = true;
+			pc += 2;
+			break;
+		case 0x00FC:  // scroll left 4 pixels
+			scroll_left();
+			draw_flag = true;
+			pc += 2;
+			break;
+		case 0x00FD:  // exit, pc stays put so the interpreter halts here
+			halt(HaltReason::Exit);
+			break;
+		case 0x00FE:  // 64x32 mode
+			set_hires(false);
+			pc += 2;
+			break;
+		case 0x00FF:  // 128x64 mode
+			set_hires(true);
+			pc += 2;
+			break;
 		default:  // invalid opcode found
-			std::cerr << "Undefined 0x0000 opcode: " << opcode << "\n";
+			hooks.on_undefined_opcode(pc, opcode);
+			halt(HaltReason::UndefinedOpcode);
 		}
 		break;
 	case 0x1000:  // 0x1nnn, jump to address nnn
-		pc = opcode & 0x0FFF;
+	{
+		std::uint16_t target = opcode & 0x0FFF;
+		if (idle_loops[target]) {
+			// a jump to itself never leaves, a timer wait spins until the
+			// delay timer runs out which cannot happen before the frame ends
+			if (target == pc) {
+				idle_period = 1;
+			}
+			else if (pc == target + 4 && delay_timer > 0 &&
+				is_timer_loop(target, read(target) << 8 | read(target + 1), read(target + 2) << 8 | read(target + 3), opcode)) {
+				idle_period = 3;
+			}
+		}
+		pc = target;
 		break;
+	}
 	case 0x2000:           // 0x2nnn, call address nnn
+		if (sp == stack.size()) {
+			halt(HaltReason::StackOverflow);
+			break;
+		}
 		stack[sp++] = pc;  // store current address on stack first
 		pc = opcode & 0x0FFF;
 		break;
 	case 0x3000:  // 0x3xkk, skip next instruction if Vx = kk
 		pc += 2;
 		if (V[x] == kk) {
-			pc += 2;
+			skip_next();
 		}
 		break;
 	case 0x4000:  // 0x4xk, skip next instruction if Vx != kk
 		pc += 2;
 		if (V[x] != kk) {
-			pc += 2;
+			skip_next();
 		}
 		break;
-	case 0x5000:  // 0x5xy0, skip next instruction if Vx == Vy
-		pc += 2;
-		if (V[x] == V[y]) {
+	case 0x5000:  // possible instructions are 0x5xy0 and xo-chip 0x5xy2, 0x5xy3
+		switch (n) {
+		case 0x0000:  // 0x5xy0, skip next instruction if Vx == Vy
+			pc += 2;
+			if (V[x] == V[y]) {
+				skip_next();
+			}
+			break;
+		case 0x0002:  // 0x5xy2, store Vx - Vy at I in either order, I unchanged
 			pc += 2;
+			for (int i = 0; i <= std::abs(x - y); i++) {
+				write_observed<Observer>(I + i, V[x <= y ? x + i : x - i]);
+			}
+			break;
+		case 0x0003:  // 0x5xy3, read Vx - Vy from I in either order, I unchanged
+			pc += 2;
+			for (int i = 0; i <= std::abs(x - y); i++) {
+				V[x <= y ? x + i : x - i] = read(I + i);
+			}
+			break;
+		default:  // invalid opcode found
+			hooks.on_undefined_opcode(pc, opcode);
+			halt(HaltReason::UndefinedOpcode);
 		}
 		break;
 	case 0x6000:  // 0x6xkk, puts value kk into Vx
@@ -133,14 +668,23 @@ void Chip8::emulate_cycle() {
 		case 0x0001:  // 0x8xy1, set Vx = Vx OR Vy
 			pc += 2;
 			V[x] |= V[y];
+			if constexpr (Quirks::logic_resets_vf) {
+				V[0xF] = 0;
+			}
 			break;
 		case 0x0002:  // 0x8xy2, set Vx = Vx AND Vy
 			pc += 2;
 			V[x] &= V[y];
+			if constexpr (Quirks::logic_resets_vf) {
+				V[0xF] = 0;
+			}
 			break;
 		case 0x0003:  // 0x8xy3, set Vx = Vx XOR Vy
 			pc += 2;
 			V[x] ^= V[y];
+			if constexpr (Quirks::logic_resets_vf) {
+				V[0xF] = 0;
+			}
 			break;
 		case 0x0004:  // 0x8xy4, set Vx = Vx + Vy, VF = carry
 			pc += 2;
@@ -154,9 +698,11 @@ void Chip8::emulate_cycle() {
 			break;
 		case 0x0006:  // 0x8xy6, Vx = Vx SHR 1, VF = LSB prior to shift
 			pc += 2;
+			if constexpr (Quirks::shift_uses_vy) {
+				V[x] = V[y];
+			}
 			V[0xF] = V[x] & 1;  // set as V[x]'s least significant bit
 			V[x] >>= 1;
-			// V[x] = V[y] >> 1;  // breaks Zophar ROMS
 			break;
 		case 0x0007:  // 0x8xy7, set Vx = Vy - Vx, VF = NOT borrow
 			pc += 2;
@@ -165,18 +711,21 @@ void Chip8::emulate_cycle() {
 			break;
 		case 0x000E:  // 0x8xyE, Vx = Vx SHL 1, VF = MSB prior to shift
 			pc += 2;
+			if constexpr (Quirks::shift_uses_vy) {
+				V[x] = V[y];
+			}
 			V[0xF] = V[x] >> 7;  // MSB = 8th bit since VF is an uint8_t
 			V[x] <<= 1;
-			// V[x] = V[y] << 1;  // breaks Zophar ROMS
 			break;
 		default:  // invalid opcode found
-			std::cerr << "Undefined 0x8000 opcode: " << opcode << "\n";
+			hooks.on_undefined_opcode(pc, opcode);
+			halt(HaltReason::UndefinedOpcode);
 		}
 		break;
 	case 0x9000:  // 0x9xy0, skip next instruction if Vx != Vy
 		pc += 2;
 		if (V[x] != V[y]) {
-			pc += 2;
+			skip_next();
 		}
 		break;
 	case 0xA000:  // 0xAnnn, set I = nnn
@@ -184,78 +733,79 @@ void Chip8::emulate_cycle() {
 		I = opcode & 0xFFF;
 		break;
 	case 0xB000:  // 0xBnnn, jump to location nnn + V0
-		pc = (opcode & 0xFFF) + V[0];
+		pc = (opcode & 0xFFF) + V[Quirks::jump_uses_vx ? x : 0];
 		break;
 	case 0xC000:  // 0xCxkk, set Vx = random byte and kk
 		pc += 2;
-		{  // to prevent initialization error
-			V[x] = std::uniform_int_distribution<>(0, 255)(gen) & kk;
-		}
+		V[x] = next_random() & kk;
 		break;
-	case 0xD000:  // 0xDxyn, draws sprite
-		// sprite is 8 x n pixels and located at (Vx, Vy)
+	case 0xD000:  // 0xDxyn, draws an 8 x n sprite, or 16 x 16 when n is 0
 		pc += 2;
-		draw_flag = true;
-		V[0xF] = 0;
-		std::uint8_t pixel_row;  // each pixel in a row is 1 bit
-		for (int y_line = 0; y_line < n; ++y_line) {
-			pixel_row = memory[I + y_line];  // sprite starts at I
-			for (int x_line = 0; x_line < 8; ++x_line) {
-				// go through the row 1 bit at a time
-				// true if pixel needs to be drawn
-				if (pixel_row & (0b10000000 >> x_line)) {
-					// the coordinate in row-major form
-					// must be modded with 2048 for proper wrapping
-					std::uint16_t coord = (V[x] + x_line + ((V[y] + y_line) * 64)) % 2048;
-					bool collision = (graphics[coord] == 1);
-					// OR with collision because VF is 1 when there is at
-					// least one collision
-					V[0xF] |= collision;
-					graphics[coord] ^= 1;
-				}
-			}
-		}
+		hooks.on_draw_begin();
+		draw_sprite<Quirks>(V[x], V[y], n);
+		hooks.on_draw(V[x], V[y], n);
 		break;
 	case 0xE000:  // possible instructions are 0xEx9E, 0xExA1
 		switch (kk) {
 		case 0x009E:  // 0xEx9E, skip next instruction if keypress = Vx
 			pc += 2;
-			if (keys[V[x]]) {
-				pc += 2;
+			if (keys >> (V[x] & 0xF) & 1) {
+				skip_next();
 			}
 			break;
 		case 0x00A1:  // 0xExA1, skip next instruction if keypress != Vx
 			pc += 2;
-			if (!keys[V[x]]) {
-				pc += 2;
+			if (!(keys >> (V[x] & 0xF) & 1)) {
+				skip_next();
 			}
 			break;
 		default:  // invalid opcode found
-			std::cerr << "Undefined 0xEx00 opcode: " << opcode << "\n";
+			hooks.on_undefined_opcode(pc, opcode);
+			halt(HaltReason::UndefinedOpcode);
 		}
 		break;
-	case 0xF000:  // possible instructions: 0xFx(07,0A,15,18,1E,29,33,55,65)
+	case 0xF000:  // possible instructions: 0xFx(00,01,02,07,0A,15,18,1E,29,30,33,3A,55,65,75,85)
 		switch (kk) {
+		case 0x0000:  // 0xF000 nnnn, set I = the 16 bit address in the next word
+			if (x != 0) {
+				hooks.on_undefined_opcode(pc, opcode);
+				halt(HaltReason::UndefinedOpcode);
+				break;
+			}
+			I = read(pc + 2) << 8 | read(pc + 3);
+			pc += 4;
+			break;
+		case 0x0001:  // 0xFn01, select the planes later drawing works on
+			pc += 2;
+			planes = x & 3;
+			break;
+		case 0x0002:  // 0xF002, load 16 bytes of audio pattern from I
+			if (x != 0) {
+				hooks.on_undefined_opcode(pc, opcode);
+				halt(HaltReason::UndefinedOpcode);
+				break;
+			}
+			pc += 2;
+			for (int i = 0; i < 16; i++) {
+				pattern[i] = read(I + i);
+			}
+			pattern_set = true;
+			break;
 		case 0x0007:  // 0xFx07, set Vx = delay timer value
 			pc += 2;
 			V[x] = delay_timer;
 			break;
 		case 0x000A:  // 0xFx0A, wait for keypress, store value in Vx
-		{
-			bool waiting = true;
-			for (int i = 0; i < keys.size(); ++i) {
-				if (keys[i] != 0) {
-					V[x] = i;
-					waiting = false;
-					break;
-				}
+			if (keys == 0) {
+				idle_period = 1;  // pc stays put and the wait runs again
+				break;
 			}
-			if (waiting) {
-				return;
+			V[x] = 0;
+			while (!(keys >> V[x] & 1)) {  // lowest pressed key wins
+				V[x]++;
 			}
 			pc += 2;
 			break;
-		}
 		case 0x0015:  // 0xFx15, set delay timer = Vx
 			pc += 2;
 			delay_timer = V[x];
@@ -266,39 +816,471 @@ void Chip8::emulate_cycle() {
 			break;
 		case 0x001E:  // 0xFx1E, set I = I + Vx
 			pc += 2;
-			V[0xF] = (I + V[x]) > 0xFFF;  // check for carry
+			if constexpr (Quirks::index_overflow_sets_vf) {
+				V[0xF] = (I + V[x]) > 0xFFF;  // check for carry
+			}
 			I += V[x];
 			break;
 		case 0x0029:  // 0xFx29, set I = location of sprite for digit Vx
 			pc += 2;
 			I = V[x] * 5;  // sprites are 4x5
 			break;
+		case 0x0030:  // 0xFx30, set I = location of 8x10 sprite for digit Vx
+			pc += 2;
+			I = BIG_FONT + (V[x] & 0xF) * 10;
+			break;
 		case 0x0033:
 			// 0xFx33, store BCD representation of Vx at I, I+1, I+2
 			pc += 2;
-			memory[I] = V[x] / 100;
-			memory[I + 1] = (V[x] / 10) % 10;
-			memory[I + 2] = V[x] % 10;
+			write_observed<Observer>(I, V[x] / 100);
+			write_observed<Observer>(I + 1, (V[x] / 10) % 10);
+			write_observed<Observer>(I + 2, V[x] % 10);
+			break;
+		case 0x003A:  // 0xFx3A, set audio pattern playback pitch = Vx
+			pc += 2;
+			pitch = V[x];
 			break;
 		case 0x0055:  // 0xFx55, stores V0 - Vx in memory starting at I
 			pc += 2;
 			for (int i = 0; i <= x; i++) {
-				memory[I + i] = V[i];
+				write_observed<Observer>(I + i, V[i]);
+			}
+			if constexpr (Quirks::load_store_increments_i) {
+				I += x + 1;
 			}
 			break;
 		case 0x0065:  // 0xFx65, read V0 - Vx from memory starting at I
 			pc += 2;
 			for (int i = 0; i <= x; i++) {
-				V[i] = memory[I + i];
+				V[i] = read(I + i);
+			}
+			if constexpr (Quirks::load_store_increments_i) {
+				I += x + 1;
 			}
 			break;
+		case 0x0075:  // 0xFx75, store V0 - Vx in the flag registers
+			pc += 2;
+			std::copy(V.begin(), V.begin() + x + 1, rpl.begin());
+			break;
+		case 0x0085:  // 0xFx85, read V0 - Vx from the flag registers
+			pc += 2;
+			std::copy(rpl.begin(), rpl.begin() + x + 1, V.begin());
+			break;
 		default:  // invalid opcode found
-			std::cerr << "Undefined 0xF000 opcode: " << opcode << "\n";
+			hooks.on_undefined_opcode(pc, opcode);
+			halt(HaltReason::UndefinedOpcode);
 		}
 		break;
 	default:  // invalid opcode found
-		std::cerr << "Undefined opcode: " << opcode << "\n";
+		hooks.on_undefined_opcode(pc, opcode);
+		halt(HaltReason::UndefinedOpcode);
+	}
+	if (hooks.on_execute(*this)) {
+		halt(HaltReason::Break);
+	}
+}
+
+template <typename Quirks, typename Observer>
+void Chip8::execute_frame(int instructions, const KeyEvent* events, int event_count) {
+	Observer& hooks = *static_cast<Observer*>(observer);
+	hooks.on_frame_begin(cycles);
+
+	// events are sorted by cycle, each is applied right before its cycle runs
+	int next = 0;
+	for (int i = 0; i < instructions; i++) {
+		while (next < event_count && events[next].cycle <= cycles) {
+			apply_key(events[next++]);
+		}
+		execute<Quirks, Observer>();
+		if (idle_period != 0) {
+			// a halted machine runs nothing more, so no cycles are counted for
+			// the rest of the frame
+			if (halt_reason != HaltReason::None) {
+				idle_period = 0;
+				break;
+			}
+			// a key wait can end at the next key event, it is only skipped
+			// once there are none left this frame
+			if constexpr (std::is_same<Observer, NullObserver>::value) {
+				if (next == event_count || (opcode & 0xF0FF) != 0xF00A) {
+					skip_idle(instructions - i - 1);
+					break;
+				}
+			}
+			idle_period = 0;
+		}
+	}
+	// anything stamped past the end of the frame still lands before the next
+	while (next < event_count) {
+		apply_key(events[next++]);
+	}
+	step_timers();
+	hooks.on_frame(cycles);
+}
+
+template <typename Quirks>
+void Chip8::execute_frame_compiled(int instructions, const KeyEvent* events, int event_count) {
+	// translated blocks run while the frame has room for them and whatever
+	// they stop at is interpreted one instruction at a time; a key event caps
+	// the budget so it still lands right before its cycle
+	int next = 0;
+	int remaining = instructions;
+	while (remaining > 0) {
+		while (next < event_count && events[next].cycle <= cycles) {
+			apply_key(events[next++]);
+		}
+		int budget = remaining;
+		if (next < event_count && events[next].cycle - cycles < static_cast<std::uint64_t>(budget)) {
+			budget = static_cast<int>(events[next].cycle - cycles);
+		}
+		bool invalidated = false;
+		int ran = compiled->run(*this, budget, invalidated);
+		cycles += ran;
+		remaining -= ran;
+		if (!invalidated && ran == budget) {
+			continue;
+		}
+		if (!invalidated && remaining > 0) {
+			std::uint16_t index = I;
+			execute<Quirks, NullObserver>();
+			remaining--;
+			if (idle_period != 0 && (next == event_count || (opcode & 0xF0FF) != 0xF00A)) {
+				skip_idle(halt_reason == HaltReason::None ? remaining : 0);
+				remaining = 0;
+			}
+			idle_period = 0;
+			invalidated = writes_compiled(index);
+		}
+		if (invalidated) {
+			// the rest of the frame and everything after is interpreted
+			drop_compiled();
+			execute_frame<Quirks, NullObserver>(remaining, events + next, event_count - next);
+			return;
+		}
+	}
+	while (next < event_count) {
+		apply_key(events[next++]);
+	}
+	step_timers();
+}
+
+template <typename Quirks>
+void Chip8::draw_sprite(std::uint8_t vx, std::uint8_t vy, int n) {
+	// every sprite row is shifted into place across the row's words and
+	// xored in with one operation per word instead of one per pixel
+	int width = get_width();
+	int height = get_height();
+	int sprite_width = n == 0 ? 16 : 8;
+	int rows = n == 0 ? 16 : n;
+	int start_x = vx & (width - 1);  // the start position always wraps
+	int start_y = vy & (height - 1);
+	draw_flag = true;
+	V[0xF] = 0;
+
+	// the placement is the same for every row, only the bits change
+	int left_shift = start_x < 64 ? start_x : 0;
+	int right_shift = start_x < 64 ? 64 - start_x : start_x - 64;
+	int spill_shift = start_x < 64 ? 64 - start_x : 128 - start_x;
+
+	// with both planes selected the sprite data for the second follows the first
+	std::uint16_t address = I;
+	for (int plane = 0; plane < 2; plane++) {
+		if (!(planes >> plane & 1)) {
+			continue;
+		}
+		for (int line = 0; line < rows; line++) {
+			int row = start_y + line;
+			if (row >= height) {
+				if constexpr (!Quirks::sprites_wrap) {
+					break;
+				}
+				row -= height;
+			}
+			std::uint64_t bits = sprite_width == 16 ? read(address + line * 2) << 8 | read(address + line * 2 + 1) : read(address + line);
+			bits <<= 64 - sprite_width;
+
+			// pixels past the right edge end up in spill, they wrap or clip per quirk
+			std::uint64_t left, right, spill;
+			if (start_x < 64) {
+				left = bits >> left_shift;
+				right = start_x == 0 ? 0 : bits << right_shift;
+				spill = 0;
+			}
+			else {
+				left = 0;
+				right = bits >> right_shift;
+				spill = start_x == 64 ? 0 : bits << spill_shift;
+			}
+			if (!hires) {  // a low resolution row is only the first word
+				spill = right;
+				right = 0;
+			}
+			if constexpr (Quirks::sprites_wrap) {
+				left |= spill;
+			}
+			std::uint64_t* words = &graphics[row * 4 + plane * 2];
+			V[0xF] |= ((words[0] & left) | (words[1] & right)) != 0;
+			words[0] ^= left;
+			words[1] ^= right;
+		}
+		address += rows * (sprite_width / 8);
+	}
+}
+
+// scrolling moves whole words and only in the selected planes; a row is four
+// adjacent words, plane 0 then plane 1, each blended in through a mask so a
+// vertical scroll is a copy per word and a horizontal one a shift; distances
+// are in pixels of the current mode
+void Chip8::scroll_down(int n) {
+	int height = get_height();
+	std::array<std::uint64_t, 4> mask = plane_masks(planes);
+	for (int row = height - 1; row >= 0; row--) {
+		for (int i = 0; i < 4; i++) {
+			std::uint64_t moved = row >= n ? graphics[(row - n) * 4 + i] : 0;
+			graphics[row * 4 + i] = (graphics[row * 4 + i] & ~mask[i]) | (moved & mask[i]);
+		}
+	}
+}
+
+void Chip8::scroll_up(int n) {
+	int height = get_height();
+	std::array<std::uint64_t, 4> mask = plane_masks(planes);
+	for (int row = 0; row < height; row++) {
+		for (int i = 0; i < 4; i++) {
+			std::uint64_t moved = row + n < height ? graphics[(row + n) * 4 + i] : 0;
+			graphics[row * 4 + i] = (graphics[row * 4 + i] & ~mask[i]) | (moved & mask[i]);
+		}
+	}
+}
+
+void Chip8::scroll_left() {
+	std::array<std::uint64_t, 4> mask = plane_masks(planes);
+	for (int row = 0; row < get_height(); row++) {
+		std::uint64_t* words = &graphics[row * 4];
+		for (int i = 0; i < 4; i += 2) {
+			std::uint64_t left = words[i] << 4 | (hires ? words[i + 1] >> 60 : 0);
+			std::uint64_t right = words[i + 1] << 4;
+			words[i] = (words[i] & ~mask[i]) | (left & mask[i]);
+			words[i + 1] = (words[i + 1] & ~mask[i]) | (right & mask[i]);
+		}
+	}
+}
+
+void Chip8::scroll_right() {
+	std::array<std::uint64_t, 4> mask = plane_masks(planes);
+	for (int row = 0; row < get_height(); row++) {
+		std::uint64_t* words = &graphics[row * 4];
+		for (int i = 0; i < 4; i += 2) {
+			std::uint64_t left = words[i] >> 4;
+			std::uint64_t right = hires ? words[i + 1] >> 4 | words[i] << 60 : 0;
+			words[i] = (words[i] & ~mask[i]) | (left & mask[i]);
+			words[i + 1] = (words[i + 1] & ~mask[i]) | (right & mask[i]);
+		}
+	}
+}
+
+void Chip8::skip_next() {
+	// F000 nnnn is four bytes long and skipped as one instruction
+	pc += (read(pc) == 0xF0 && read(pc + 1) == 0x00) ? 4 : 2;
+}
+
+void Chip8::set_hires(bool enabled) {
+	hires = enabled;
+	graphics.fill(0);
+	draw_flag = true;
+}
+
+void Chip8::halt(HaltReason reason) {
+	// ends the frame through the idle loop exit, pc stays on the instruction
+	// and later frames only run the timers until resumed
+	if (halt_reason == HaltReason::None) {
+		halt_reason = reason;
+		// exit and break are asked for, only the faults are counted
+		if (reason != HaltReason::Exit && reason != HaltReason::Break) {
+			faults[static_cast<int>(reason)]++;
+		}
+		(this->*select_fn)();
 	}
+	idle_period = 1;
+}
+
+void Chip8::pause() {
+	halt(HaltReason::Break);
+	idle_period = 0;  // not inside a frame, nothing to end
+}
+
+HaltReason Chip8::get_halt_reason() {
+	return halt_reason;
+}
+
+bool Chip8::is_stalled() {
+	if (delay_timer != 0 || sound_timer != 0) {
+		return false;
+	}
+	if (halt_reason != HaltReason::None) {
+		return true;
+	}
+	std::uint16_t next = read(pc) << 8 | read(pc + 1);
+	return (keys == 0 && (next & 0xF0FF) == 0xF00A) || (pc < 0x1000 && next == (0x1000 | pc));
+}
+
+int Chip8::get_timer_wait() {
+	if (halt_reason != HaltReason::None || delay_timer == 0) {
+		return 0;
+	}
+	// a skipped frame can leave pc anywhere in the loop; on the 3x00 the
+	// register must still hold a count, or the next pass leaves
+	for (int start = pc - 4; start <= pc; start += 2) {
+		if (start < 0 || start >= 0x1000 || !idle_loops[start]) {
+			continue;
+		}
+		std::uint16_t first = read(start) << 8 | read(start + 1);
+		if (!is_timer_loop(start, first, read(start + 2) << 8 | read(start + 3), read(start + 4) << 8 | read(start + 5))) {
+			continue;
+		}
+		if (pc != start + 2 || V[(first & 0x0F00) >> 8] != 0) {
+			return delay_timer;
+		}
+	}
+	return 0;
+}
+
+std::uint32_t Chip8::get_fault_count(HaltReason reason) {
+	return faults[static_cast<int>(reason)];
+}
+
+void Chip8::resume(bool skip) {
+	if (halt_reason == HaltReason::None) {
+		return;
+	}
+	halt_reason = HaltReason::None;
+	idle_period = 0;
+	if (skip) {
+		skip_next();
+	}
+	(this->*select_fn)();
+}
+
+const char* halt_reason_name(HaltReason reason) {
+	static const char* const names[] = { "running", "undefined opcode", "stack overflow", "stack underflow", "exit", "break" };
+	return names[static_cast<int>(reason)];
+}
+
+void Chip8::skip_idle(int remaining) {
+	// leave the machine exactly where running the remaining passes would,
+	// pc sits at the loop start and a timer wait reloads Vx on every pass
+	if (remaining > 0 && idle_period == 3) {
+		std::uint16_t last = pc + 2 * ((remaining - 1) % 3);
+		V[read(pc) & 0x0F] = delay_timer;
+		opcode = read(last) << 8 | read(last + 1);
+		pc += 2 * (remaining % 3);
+	}
+	cycles += remaining;
+	idle_period = 0;
+}
+
+template <typename Quirks, typename Observer>
+void Chip8::execute_frame_timed(int, const KeyEvent* events, int event_count) {
+	Observer& hooks = *static_cast<Observer*>(observer);
+	hooks.on_frame_begin(cycles);
+
+	// the frame's machine cycles are spent instruction by instruction, one
+	// that runs past the end is paid for out of the next frame
+	timing_credit += VIP_FRAME_CYCLES;
+	frame_instructions = 0;
+	int next = 0;
+	while (timing_credit > 0) {
+		while (next < event_count && events[next].cycle <= cycles) {
+			apply_key(events[next++]);
+		}
+		std::uint16_t before = pc;
+		execute<Quirks, Observer>();
+		if (idle_period != 0) {
+			idle_period = 0;  // idle loops are left to burn their cycles
+			if (halt_reason != HaltReason::None) {
+				timing_credit = 0;  // a halted machine does not bank cycles
+				break;
+			}
+		}
+		frame_instructions++;
+
+		const CycleCost& cost = vip_costs[cost_class(opcode)];
+		int units = 0;
+		if ((opcode & 0xF000) == 0xD000) {
+			units = (opcode & 0x000F) == 0 ? 16 : opcode & 0x000F;
+		}
+		else if ((opcode & 0xF0FF) == 0xF055 || (opcode & 0xF0FF) == 0xF065) {
+			units = ((opcode & 0x0F00) >> 8) + 1;
+		}
+		int spent = VIP_FETCH_CYCLES + cost.base + cost.per_unit * units;
+		if (static_cast<std::uint16_t>(pc - before) > 2 && cost.skip != 0) {
+			spent += cost.skip;
+		}
+
+		// Dxyn waits for the display interrupt before drawing, so the rest of
+		// this frame is lost and the drawing comes out of the next one
+		if ((opcode & 0xF000) == 0xD000) {
+			timing_credit = -(spent - VIP_FETCH_CYCLES);
+			break;
+		}
+		timing_credit -= spent;
+	}
+	while (next < event_count) {
+		apply_key(events[next++]);
+	}
+	step_timers();
+	hooks.on_frame(cycles);
+}
+
+void Chip8::execute_frame_halted(int, const KeyEvent* events, int event_count) {
+	// nothing runs, but keys and timers still move so a halted rom does not
+	// beep forever
+	for (int i = 0; i < event_count; i++) {
+		apply_key(events[i]);
+	}
+	step_timers();
+}
+
+void Chip8::apply_key(const KeyEvent& event) {
+	if (event.pressed) {
+		press_key(event.key);
+	}
+	else {
+		release_key(event.key);
+	}
+}
+
+void Chip8::save_state(Chip8State& snapshot) const {
+	snapshot = *this;
+	// shared pages were never copied into memory, take them from the image
+	for (int i = 0; i < PAGE_COUNT; i++) {
+		if (shared_pages >> i & 1) {
+			std::copy(pages[i], pages[i] + PAGE_SIZE, snapshot.memory.begin() + i * PAGE_SIZE);
+		}
+	}
+}
+
+void Chip8::load_state(const Chip8State& snapshot) {
+	static_cast<Chip8State&>(*this) = snapshot;
+	for (int i = 0; i < PAGE_COUNT; i++) {
+		pages[i] = memory.data() + i * PAGE_SIZE;
+	}
+	shared_pages = 0;
+	if (compiled != nullptr && !matches_compiled()) {
+		compiled = nullptr;
+	}
+	(this->*select_fn)();  // the snapshot may be halted or not
+}
+
+std::uint8_t Chip8::next_random() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng >> 24;
+}
+
+void Chip8::seed(std::uint32_t value) {
+	rng = value != 0 ? value : 1;
 }
 
 void Chip8::step_timers() {
@@ -311,19 +1293,47 @@ void Chip8::step_timers() {
 }
 
 void Chip8::press_key(int keycode) {
-	keys[keycode] = 1;
+	keys |= 1 << (keycode & 0xF);
 }
 
 void Chip8::release_key(int keycode) {
-	keys[keycode] = 0;
+	keys &= ~(1 << (keycode & 0xF));
+}
+
+std::uint64_t Chip8::get_cycles() {
+	return cycles;
+}
+
+std::uint16_t Chip8::get_pc() {
+	return pc;
+}
+
+std::uint8_t Chip8::peek(std::uint16_t address) {
+	return read(address);
 }
 
 void Chip8::reset_draw_flag() {
 	draw_flag = false;
 }
 
+int Chip8::get_width() {
+	return hires ? 128 : 64;
+}
+
+int Chip8::get_height() {
+	return hires ? 64 : 32;
+}
+
 std::uint8_t Chip8::get_pixel_data(int i) {
-	return graphics[i];
+	// colour index, bit n set when the pixel is lit in plane n
+	int x = i % get_width();
+	int y = i / get_width();
+	const std::uint64_t* words = &graphics[y * 4 + x / 64];
+	return (words[0] >> (63 - x % 64) & 1) | (words[2] >> (63 - x % 64) & 1) << 1;
+}
+
+const std::uint64_t* Chip8::get_row(int y) {
+	return &graphics[y * 4];
 }
 
 bool Chip8::get_draw_flag() {
@@ -332,4 +1342,34 @@ bool Chip8::get_draw_flag() {
 
 std::uint8_t Chip8::get_sound_timer() {
 	return sound_timer;
-}
\ No newline at end of file
+}
+
+bool Chip8::has_audio_pattern() {
+	return pattern_set;
+}
+
+const std::array<std::uint8_t, 16>& Chip8::get_audio_pattern() {
+	return pattern;
+}
+
+std::uint8_t Chip8::get_pitch() {
+	return pitch;
+}
+
+std::size_t Chip8::get_private_bytes() {
+	// state this instance actually touches, shared pages are not counted
+	std::size_t bytes = sizeof(Chip8);
+	for (int i = 0; i < PAGE_COUNT; i++) {
+		if (shared_pages >> i & 1) {
+			bytes -= PAGE_SIZE;
+		}
+	}
+	return bytes;
+}
+
+// every observer type that can be attached, each one compiles its own copy
+// of the interpreters
+template void Chip8::set_observer<NullObserver>(NullObserver* attached);
+template void Chip8::set_observer<Profiler>(Profiler* attached);
+template void Chip8::set_observer<Tracer>(Tracer* attached);
+template void Chip8::set_observer<Debugger>(Debugger* attached);
@@ -2,37 +2,295 @@
 #define CHIP8
 
 #include <array>
+#include <bitset>
+#include <cstddef>
 #include <cstdint>
-#include <random>
 #include <string>
+#include "observer.h"
 
-class Chip8 {
-private:
-	std::array<uint8_t, 4096> memory;       // ram, first 512 bytes reserved
+// why the machine stopped executing; a halted machine stays at the
+// instruction that stopped it until resumed
+enum class HaltReason : std::uint8_t {
+	None,
+	UndefinedOpcode,
+	StackOverflow,   // 2nnn with all 16 levels in use
+	StackUnderflow,  // 00EE with nothing to return to
+	Exit,            // super-chip 00FD, not a fault
+	Break,           // stopped by an observer or pause(), a debugger breakpoint or step
+	Count
+};
+
+// everything the machine needs to resume execution, kept as plain data so a
+// snapshot is a single copy with no allocation
+struct Chip8State {
+	std::array<uint8_t, 65536> memory;      // ram, first 512 bytes reserved, xo-chip uses all 64 KB
 	std::array<uint8_t, 16> V;              // general registers, VF = carry bit
 	std::array<uint16_t, 16> stack;         // subroutine return addresses
-	std::array<uint8_t, 16> keys;           // stores hexadecimal keypad
-	std::array<uint8_t, 64 * 32> graphics;  // holds pixel data
+	std::array<uint64_t, 64 * 4> graphics;  // 128x64 pixels in two planes, per row plane 0 words then plane 1, msb leftmost
 	std::uint8_t delay_timer;               // decrements at 60Hz when nonzero
 	std::uint8_t sound_timer;               // decrements at 60Hz when nonzero
 	std::uint16_t I;                        // stores memory addresses
 	std::uint16_t pc;                       // currently executing address
 	std::uint16_t sp;                       // points to top of stack
 	std::uint16_t opcode;                   // current instruction
-	std::random_device rd;                  // used to obtain seed for generator
-	std::mt19937 gen;                       // generates pseudo-random numbers
+	std::uint16_t keys;                     // hexadecimal keypad, bit n = key n held
+	std::uint64_t cycles;                   // instructions executed since power on
+	std::uint32_t rng;                      // xorshift32 state for 0xCxkk
 	bool draw_flag;                         // true when gfx needs to be updated
+	bool hires;                             // super-chip 128x64 mode, else 64x32 in the top left
+	std::array<uint8_t, 16> rpl;            // super-chip flag registers for Fx75/Fx85
+	std::uint8_t planes;                    // xo-chip planes drawn, cleared and scrolled, bit n = plane n
+	std::array<uint8_t, 16> pattern;        // xo-chip 1-bit audio samples from F002
+	std::uint8_t pitch;                     // xo-chip playback rate from Fx3A, 64 = 4000 Hz
+	bool pattern_set;                       // false until F002 runs, the frontend beeps until then
+	std::int32_t timing_credit;             // vip machine cycles left this frame, negative when overdrawn
+	HaltReason halt_reason;                 // None while running
+	std::array<uint32_t, static_cast<int>(HaltReason::Count)> faults;  // times each fault halted the machine, exit and break stay 0
+};
+
+// behaviours that differ between chip-8 interpreters, a rom written for one
+// of them may misbehave on the others
+enum class QuirkProfile {
+	Legacy,     // what earlier AXChip8 releases did
+	CosmacVip,  // the original 1977 interpreter
+	Chip48,     // hp-48 calculators
+	SuperChip,  // super-chip 1.1
+	XoChip      // octo's xo-chip
+};
+
+template <QuirkProfile P>
+struct Quirks;
+
+template <>
+struct Quirks<QuirkProfile::Legacy> {
+	static constexpr bool shift_uses_vy = false;            // 8xy6/8xyE shift Vy into Vx
+	static constexpr bool load_store_increments_i = false;  // Fx55/Fx65 leave I past the last register
+	static constexpr bool jump_uses_vx = false;             // Bxnn jumps to xnn + Vx instead of nnn + V0
+	static constexpr bool logic_resets_vf = false;          // 8xy1/8xy2/8xy3 clear VF
+	static constexpr bool index_overflow_sets_vf = true;    // Fx1E sets VF when I passes 0xFFF
+	static constexpr bool sprites_wrap = true;              // sprites wrap around instead of clipping
+};
+
+template <>
+struct Quirks<QuirkProfile::CosmacVip> {
+	static constexpr bool shift_uses_vy = true;
+	static constexpr bool load_store_increments_i = true;
+	static constexpr bool jump_uses_vx = false;
+	static constexpr bool logic_resets_vf = true;
+	static constexpr bool index_overflow_sets_vf = false;
+	static constexpr bool sprites_wrap = false;
+};
+
+template <>
+struct Quirks<QuirkProfile::Chip48> {
+	static constexpr bool shift_uses_vy = false;
+	static constexpr bool load_store_increments_i = true;
+	static constexpr bool jump_uses_vx = true;
+	static constexpr bool logic_resets_vf = false;
+	static constexpr bool index_overflow_sets_vf = false;
+	static constexpr bool sprites_wrap = false;
+};
+
+template <>
+struct Quirks<QuirkProfile::SuperChip> {
+	static constexpr bool shift_uses_vy = false;
+	static constexpr bool load_store_increments_i = false;
+	static constexpr bool jump_uses_vx = true;
+	static constexpr bool logic_resets_vf = false;
+	static constexpr bool index_overflow_sets_vf = false;
+	static constexpr bool sprites_wrap = false;
+};
+
+template <>
+struct Quirks<QuirkProfile::XoChip> {
+	static constexpr bool shift_uses_vy = true;
+	static constexpr bool load_store_increments_i = true;
+	static constexpr bool jump_uses_vx = false;
+	static constexpr bool logic_resets_vf = false;
+	static constexpr bool index_overflow_sets_vf = false;
+	static constexpr bool sprites_wrap = true;
+};
+
+// how the length of a frame is measured
+enum class TimingMode {
+	Instructions,  // a fixed number of instructions per frame
+	CosmacVip      // the machine cycles the original interpreter had per frame
+};
+
+// how a particular rom wants to be run, see RomDatabase
+struct RomSettings {
+	std::uint16_t instructions_per_frame = 10;  // 0 runs with TimingMode::CosmacVip
+	QuirkProfile quirks = QuirkProfile::Legacy;
+	std::uint32_t background = 0x000000FF;  // RGBA8888 colour of unlit pixels
+	std::uint32_t foreground = 0xFFFFFFFF;  // RGBA8888 colour of lit pixels
+	std::array<std::uint8_t, 16> keymap = { { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7,
+		0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE, 0xF } };  // keypad key for each frontend key
+};
+
+class RomDatabase;
+struct CompiledRom;
+struct RomAnalysis;
+
+const char* halt_reason_name(HaltReason reason);
+
+// a keypad change that takes effect right before the given cycle executes
+struct KeyEvent {
+	std::uint64_t cycle;
+	std::uint8_t key;
+	bool pressed;
+};
+
+// font and program laid out as a memory image that any number of instances
+// running the same rom can read from instead of holding their own copy,
+// with the settings and idle loops a load_rom would find, worked out once
+class SharedRom {
+private:
+	friend class Chip8;
+	alignas(64) std::array<std::uint8_t, 65536> image;
+	RomSettings settings;
+	std::uint64_t rom_hash;
+	std::bitset<4096> idle_loops;
+
+public:
+	// analysis is scratch for roms the database does not know, passing the
+	// same one for every load keeps them from allocating
+	bool load(const std::uint8_t* data, std::size_t size, const RomDatabase* database = nullptr,
+		RomAnalysis* analysis = nullptr);
+};
+
+class Chip8 : private Chip8State {
+private:
+	// memory is read through a page table so pages can come from a SharedRom
+	// or a common zero page; a shared page is copied into this instance's
+	// memory on its first write, so the untouched bulk of 64 KB stays cold
+	static constexpr int PAGE_SIZE = 1024;
+	static constexpr int PAGE_COUNT = 65536 / PAGE_SIZE;
+	std::array<const std::uint8_t*, PAGE_COUNT> pages;
+	std::uint64_t shared_pages;             // bit n set while page n is shared
+
+	// one interpreter is compiled per quirk profile and observer so the hot
+	// loop never tests a quirk or a hook at runtime, loading a rom or
+	// attaching an observer picks which one runs
+	QuirkProfile profile;
+	TimingMode timing;
+	void (Chip8::*cycle_fn)();
+	void (Chip8::*frame_fn)(int instructions, const KeyEvent* events, int event_count);
+	void (Chip8::*select_fn)();             // picks the interpreter for the attached observer's type
+	void* observer;
+	int frame_instructions;                 // executed by the last cycle timed frame
+
+	template <typename Observer>
+	void select_interpreter();
+	template <QuirkProfile P, typename Observer>
+	void use_interpreter();
+	template <typename Quirks, typename Observer>
+	void execute();
+	template <typename Quirks, typename Observer>
+	void execute_frame(int instructions, const KeyEvent* events, int event_count);
+	template <typename Quirks, typename Observer>
+	void execute_frame_timed(int instructions, const KeyEvent* events, int event_count);
+	void execute_frame_halted(int instructions, const KeyEvent* events, int event_count);
+	template <typename Quirks>
+	void execute_frame_compiled(int instructions, const KeyEvent* events, int event_count);
+
+	// an ahead of time translation of the loaded rom, run in place of the
+	// interpreter while nothing observes the machine; dropped for good once
+	// anything writes to the code it was made from
+	const CompiledRom* compiled;
+	bool matches_compiled();
+	bool writes_compiled(std::uint16_t index);
+	void drop_compiled();
+
+	// settings come from the database when it knows the rom's hash
+	const RomDatabase* database;
+	RomSettings settings;
+	std::uint64_t rom_hash;
+
+	// roms without settings are analyzed instead, jumps into the idle loops
+	// found there end the frame early rather than spinning until it is over
+	RomAnalysis* analysis;                  // lent by the caller, nullptr analyzes into a temporary
+	std::bitset<4096> idle_loops;
+	int idle_period;                        // instructions per loop pass, 0 when not idle
+
+	void reset_registers();
+	void reset_memory();
+	void apply_settings(std::size_t rom_size);
+	void skip_idle(int remaining);
+	void halt(HaltReason reason);
+	template <typename Quirks>
+	void draw_sprite(std::uint8_t vx, std::uint8_t vy, int n);
+	void scroll_down(int n);
+	void scroll_up(int n);
+	void scroll_left();
+	void scroll_right();
+	void skip_next();
+	void set_hires(bool enabled);
+	std::uint8_t read(std::uint16_t address);
+	void write(std::uint16_t address, std::uint8_t value);
+	template <typename Observer>
+	void write_observed(std::uint16_t address, std::uint8_t value);
+	void privatize(int page);
+	void privatize_range(std::size_t end);
+	std::uint8_t next_random();
+	void apply_key(const KeyEvent& event);
 
 public:
 	Chip8();
-	void load_rom(std::string path);
+	explicit Chip8(const SharedRom& rom);
+	Chip8(const Chip8&) = delete;
+	Chip8& operator=(const Chip8&) = delete;
+	// both start from power on, a machine can be reused for rom after rom
+	// without the cost of constructing another
+	bool load_rom(std::string path);
+	bool load_rom(const std::uint8_t* data, std::size_t size);
+	void set_database(const RomDatabase* db);
+	void set_analysis(RomAnalysis* scratch);  // reused by every load, so corpus runs do not allocate
+	const RomSettings& get_settings();
+	std::uint64_t get_rom_hash();
+	void set_quirk_profile(QuirkProfile quirks);
+	QuirkProfile get_quirk_profile();
+	void set_timing_mode(TimingMode mode);
+	TimingMode get_timing_mode();
+	int get_frame_instructions();
+	// observers are compiled into chip8.cpp, each type is instantiated there
+	template <typename Observer>
+	void set_observer(Observer* attached);
+	void clear_observer();
+	bool set_compiled(const CompiledRom* rom);  // false when it does not match the loaded rom
+	const CompiledRom* get_compiled();
 	void emulate_cycle();
+	void run_frame(int instructions, const KeyEvent* events = nullptr, int event_count = 0);
+	void save_state(Chip8State& snapshot) const;
+	void load_state(const Chip8State& snapshot);
+	void seed(std::uint32_t value);  // makes Cxkk repeatable, power on seeds from std::random_device
 	void press_key(int keycode);
 	void release_key(int keycode);
+	std::uint64_t get_cycles();
+	std::uint16_t get_pc();
+	std::uint8_t peek(std::uint16_t address);
 	void step_timers();
 	bool get_draw_flag();
 	void reset_draw_flag();
+	int get_width();
+	int get_height();
 	std::uint8_t get_pixel_data(int i);
+	const std::uint64_t* get_row(int y);
 	std::uint8_t get_sound_timer();
+	bool has_audio_pattern();
+	const std::array<std::uint8_t, 16>& get_audio_pattern();
+	std::uint8_t get_pitch();
+	HaltReason get_halt_reason();
+	// nothing but the cycle count changes until a key is pressed or the
+	// machine is resumed: halted, waiting on Fx0A with no key held or jumping
+	// to itself, with both timers run down
+	bool is_stalled();
+	// frames left in a timer wait the analyzer found (Fx07, 3x00, jump
+	// back), during which the machine only spins and counts its timers
+	// down; 0 when it is not in one
+	int get_timer_wait();
+	std::uint32_t get_fault_count(HaltReason reason);
+	void pause();
+	void resume(bool skip);
+	std::size_t get_private_bytes();
 };
 #endif
\ No newline at end of file
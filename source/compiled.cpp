@@ -0,0 +1,24 @@
+#include "compiled.h"
+#include <vector>
+
+namespace {
+// function local so registrations from other translation units can run
+// before anything here is initialized
+std::vector<const CompiledRom*>& registry() {
+	static std::vector<const CompiledRom*> roms;
+	return roms;
+}
+}
+
+CompiledRomRegistration::CompiledRomRegistration(const CompiledRom* rom) {
+	registry().push_back(rom);
+}
+
+const CompiledRom* find_compiled_rom(std::uint64_t rom_hash) {
+	for (const CompiledRom* rom : registry()) {
+		if (rom->rom_hash == rom_hash) {
+			return rom;
+		}
+	}
+	return nullptr;
+}
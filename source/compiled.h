@@ -0,0 +1,34 @@
+#ifndef COMPILED
+#define COMPILED
+
+#include <cstddef>
+#include <cstdint>
+#include "chip8.h"
+
+// a rom translated ahead of time to C++ by tools/recompile. run executes
+// whole basic blocks straight on the state for as long as they fit in the
+// budget and returns how many instructions it ran; it stops at whatever it
+// leaves to the interpreter: draws, scrolls, key waits, faults, computed
+// jump targets and code that may be modified
+struct CompiledRom {
+	std::uint64_t rom_hash;
+	QuirkProfile quirks;            // the translation is only valid under these
+	const std::uint8_t* code_map;   // 8 KB, bit per memory byte the translation depends on
+	const std::uint8_t* image;      // the rom as translated, loaded at 0x200
+	std::size_t image_size;
+	// invalidated is set when a write landed on translated code, the
+	// translation must not run again on this machine
+	int (*run)(Chip8State& state, int budget, bool& invalidated);
+};
+
+inline bool is_translated(const CompiledRom& rom, std::uint16_t address) {
+	return rom.code_map[address >> 3] >> (address & 7) & 1;
+}
+
+// generated translation units add themselves at startup, so linking one in
+// is all a runner has to do
+struct CompiledRomRegistration {
+	explicit CompiledRomRegistration(const CompiledRom* rom);
+};
+const CompiledRom* find_compiled_rom(std::uint64_t rom_hash);
+#endif
@@ -0,0 +1,255 @@
+#include "debugger.h"
+#include "analyzer.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+Debugger::Debugger() {
+	clear();
+}
+
+void Debugger::clear() {
+	breakpoints.reset();
+	watchpoints.reset();
+	breakpoint_count = 0;
+	watchpoint_count = 0;
+	stop_pending = false;
+	pending_cause = StopCause::None;
+	over_call = false;
+	stepping_over = false;
+	return_pc = 0;
+	return_sp = 0;
+	cause = StopCause::None;
+	watch_hit = 0;
+	active = false;
+}
+
+void Debugger::update_active() {
+	active = breakpoint_count != 0 || stop_pending || stepping_over;
+}
+
+void Debugger::set_breakpoint(std::uint16_t address, bool enabled) {
+	if (breakpoints[address] != enabled) {
+		breakpoints[address] = enabled;
+		breakpoint_count += enabled ? 1 : -1;
+		update_active();
+	}
+}
+
+bool Debugger::has_breakpoint(std::uint16_t address) const {
+	return breakpoints[address];
+}
+
+void Debugger::set_watchpoint(std::uint16_t address, bool enabled) {
+	if (watchpoints[address] != enabled) {
+		watchpoints[address] = enabled;
+		watchpoint_count += enabled ? 1 : -1;
+	}
+}
+
+bool Debugger::has_watchpoint(std::uint16_t address) const {
+	return watchpoints[address];
+}
+
+void Debugger::pause(Chip8& chip8) {
+	if (chip8.get_halt_reason() == HaltReason::None) {
+		chip8.pause();
+		cause = StopCause::Pause;
+	}
+}
+
+void Debugger::resume(Chip8& chip8) {
+	// the instruction at pc runs first, so resuming from a breakpoint does
+	// not stop on it again
+	stop_pending = false;
+	stepping_over = false;
+	update_active();
+	chip8.resume(false);
+}
+
+void Debugger::step(Chip8& chip8) {
+	chip8.resume(false);
+	stop_pending = true;
+	pending_cause = StopCause::Step;
+	active = true;
+	chip8.emulate_cycle();
+}
+
+void Debugger::step_over(Chip8& chip8) {
+	over_call = true;
+	step(chip8);
+}
+
+StopCause Debugger::get_stop_cause() const {
+	return cause;
+}
+
+std::uint16_t Debugger::get_watch_hit() const {
+	return watch_hit;
+}
+
+bool Debugger::should_stop(const Chip8State& state) {
+	// the instruction halted the machine itself, a fault wins over stepping
+	if (state.halt_reason != HaltReason::None) {
+		stop_pending = false;
+		over_call = false;
+		stepping_over = false;
+		update_active();
+		return false;
+	}
+	StopCause stop = StopCause::None;
+	if (stop_pending) {
+		stop_pending = false;
+		if (pending_cause == StopCause::Step && over_call && (state.opcode & 0xF000) == 0x2000) {
+			// the call just ran, keep going until it returns to this depth
+			stepping_over = true;
+			return_pc = state.stack[state.sp - 1] + 2;
+			return_sp = state.sp - 1;
+		}
+		else {
+			stop = pending_cause;
+		}
+		over_call = false;
+	}
+	if (stop == StopCause::None && stepping_over && state.pc == return_pc && state.sp == return_sp) {
+		stop = StopCause::Step;
+	}
+	if (stop == StopCause::None && breakpoint_count != 0 && breakpoints[state.pc]) {
+		stop = StopCause::Breakpoint;
+	}
+	if (stop == StopCause::None) {
+		update_active();
+		return false;
+	}
+	cause = stop;
+	stepping_over = false;
+	update_active();
+	return true;
+}
+
+std::vector<std::string> format_registers(const Chip8State& state) {
+	std::vector<std::string> lines;
+	char line[64];
+	snprintf(line, sizeof(line), "PC %04X  I %04X  SP %X  DT %02X  ST %02X", state.pc, state.I, state.sp,
+		state.delay_timer, state.sound_timer);
+	lines.push_back(line);
+	for (int half = 0; half < 2; half++) {
+		std::string text;
+		for (int i = half * 8; i < half * 8 + 8; i++) {
+			snprintf(line, sizeof(line), "%sV%X %02X", i % 8 == 0 ? "" : "  ", i, state.V[i]);
+			text += line;
+		}
+		lines.push_back(text);
+	}
+	return lines;
+}
+
+std::string format_stack(const Chip8State& state) {
+	std::string text = "stack";
+	for (int i = 0; i < state.sp && i < static_cast<int>(state.stack.size()); i++) {
+		char entry[8];
+		snprintf(entry, sizeof(entry), " %04X", state.stack[i]);
+		text += entry;
+	}
+	return state.sp == 0 ? text + " empty" : text;
+}
+
+std::vector<std::string> format_memory(const Chip8State& state, std::uint16_t address, int rows) {
+	std::vector<std::string> lines;
+	for (int row = 0; row < rows; row++) {
+		std::uint16_t start = address + row * 8;
+		char line[64];
+		int length = snprintf(line, sizeof(line), "%04X ", start);
+		for (int i = 0; i < 8; i++) {
+			length += snprintf(line + length, sizeof(line) - length, " %02X", state.memory[static_cast<std::uint16_t>(start + i)]);
+		}
+		lines.push_back(line);
+	}
+	return lines;
+}
+
+std::vector<std::string> format_disassembly(const Chip8State& state, std::uint16_t address, int lines, const Debugger& debugger) {
+	std::vector<std::string> text;
+	for (int i = 0; i < lines; i++) {
+		std::uint16_t opcode = state.memory[address] << 8 | state.memory[static_cast<std::uint16_t>(address + 1)];
+		char line[64];
+		snprintf(line, sizeof(line), "%c%c%04X  %04X  %s", address == state.pc ? '>' : ' ',
+			debugger.has_breakpoint(address) ? '*' : ' ', address, opcode, disassemble(opcode).c_str());
+		text.push_back(line);
+		address += opcode == 0xF000 ? 4 : 2;  // the long address is data
+	}
+	return text;
+}
+
+std::vector<std::string> format_state_diff(const Chip8State& expected, const Chip8State& actual, int limit) {
+	std::vector<std::string> lines;
+	// names are only formatted for fields that differ, most calls find none
+	auto differ = [&](const char* name, int index, unsigned a, unsigned b) {
+		if (a != b && static_cast<int>(lines.size()) < limit) {
+			char field[32];
+			char line[64];
+			snprintf(field, sizeof(field), name, index);
+			snprintf(line, sizeof(line), "%-12s %X, expected %X", field, b, a);
+			lines.push_back(line);
+		}
+	};
+	differ("pc", 0, expected.pc, actual.pc);
+	differ("opcode", 0, expected.opcode, actual.opcode);
+	if (expected.cycles != actual.cycles && static_cast<int>(lines.size()) < limit) {
+		char line[64];
+		snprintf(line, sizeof(line), "%-12s %llu, expected %llu", "cycles", static_cast<unsigned long long>(actual.cycles),
+			static_cast<unsigned long long>(expected.cycles));
+		lines.push_back(line);
+	}
+	for (int i = 0; i < 16; i++) {
+		differ("V%X", i, expected.V[i], actual.V[i]);
+	}
+	differ("I", 0, expected.I, actual.I);
+	differ("sp", 0, expected.sp, actual.sp);
+	for (int i = 0; i < 16; i++) {
+		differ("stack[%d]", i, expected.stack[i], actual.stack[i]);
+	}
+	differ("delay timer", 0, expected.delay_timer, actual.delay_timer);
+	differ("sound timer", 0, expected.sound_timer, actual.sound_timer);
+	differ("keys", 0, expected.keys, actual.keys);
+	differ("rng", 0, expected.rng, actual.rng);
+	differ("draw flag", 0, expected.draw_flag, actual.draw_flag);
+	differ("hires", 0, expected.hires, actual.hires);
+	differ("planes", 0, expected.planes, actual.planes);
+	differ("pitch", 0, expected.pitch, actual.pitch);
+	differ("pattern set", 0, expected.pattern_set, actual.pattern_set);
+	differ("vip credit", 0, expected.timing_credit, actual.timing_credit);
+	differ("halt", 0, static_cast<unsigned>(expected.halt_reason), static_cast<unsigned>(actual.halt_reason));
+	for (int i = 0; i < 16; i++) {
+		differ("flags[%d]", i, expected.rpl[i], actual.rpl[i]);
+		differ("pattern[%d]", i, expected.pattern[i], actual.pattern[i]);
+	}
+	for (std::size_t i = 0; i < expected.faults.size(); i++) {
+		differ("faults[%d]", static_cast<int>(i), expected.faults[i], actual.faults[i]);
+	}
+	// the display by row, one line per row and plane that differs
+	bool display_differs = expected.graphics != actual.graphics;
+	for (int row = 0; row < 64 && display_differs; row++) {
+		for (int plane = 0; plane < 2; plane++) {
+			const std::uint64_t* a = &expected.graphics[row * 4 + plane * 2];
+			const std::uint64_t* b = &actual.graphics[row * 4 + plane * 2];
+			if ((a[0] != b[0] || a[1] != b[1]) && static_cast<int>(lines.size()) < limit) {
+				char line[64];
+				snprintf(line, sizeof(line), "row %d plane %d  %016llX%016llX", row, plane,
+					static_cast<unsigned long long>(b[0] ^ a[0]), static_cast<unsigned long long>(b[1] ^ a[1]));
+				lines.push_back(line);
+			}
+		}
+	}
+	bool memory_differs = expected.memory != actual.memory;
+	for (std::size_t i = 0; i < expected.memory.size() && memory_differs; i++) {
+		differ("memory[%04X]", static_cast<int>(i), expected.memory[i], actual.memory[i]);
+	}
+	return lines;
+}
+
+const char* stop_cause_name(StopCause cause) {
+	static const char* const names[] = { "running", "breakpoint", "watchpoint", "step", "paused" };
+	return names[static_cast<int>(cause)];
+}
@@ -0,0 +1,88 @@
+#ifndef DEBUGGER
+#define DEBUGGER
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "observer.h"
+
+// why the debugger last stopped the machine
+enum class StopCause {
+	None,
+	Breakpoint,
+	Watchpoint,
+	Step,
+	Pause
+};
+
+// breakpoints, write watchpoints and stepping for the Chip8 it is attached
+// to as observer; between commands the machine is halted with
+// HaltReason::Break. Each hook tests a flag or counter before anything
+// else, so with nothing set a debugged run only pays for being observed
+class Debugger : public NullObserver {
+private:
+	// by address rather than 4096 entries, xo-chip code can run anywhere in 64 KB
+	std::bitset<65536> breakpoints;
+	std::bitset<65536> watchpoints;
+	int breakpoint_count;
+	int watchpoint_count;
+
+	bool stop_pending;        // a watched write or a step, taken after the instruction
+	StopCause pending_cause;
+	bool over_call;           // the pending step runs a 2nnn to its return
+	bool stepping_over;       // running until the call returns
+	std::uint16_t return_pc;
+	std::uint16_t return_sp;
+
+	StopCause cause;
+	std::uint16_t watch_hit;  // the address whose write stopped the machine
+
+	// any breakpoint, pending stop or step over, the only test made per
+	// instruction while it is false
+	bool active;
+
+	bool should_stop(const Chip8State& state);
+	void update_active();
+
+public:
+	Debugger();
+
+	void set_breakpoint(std::uint16_t address, bool enabled);
+	bool has_breakpoint(std::uint16_t address) const;
+	void set_watchpoint(std::uint16_t address, bool enabled);
+	bool has_watchpoint(std::uint16_t address) const;
+	void clear();
+
+	void pause(Chip8& chip8);
+	void resume(Chip8& chip8);
+	void step(Chip8& chip8);
+	void step_over(Chip8& chip8);  // the machine keeps running frames until a called routine returns
+	StopCause get_stop_cause() const;
+	std::uint16_t get_watch_hit() const;
+
+	void on_mem_write(std::uint16_t address, std::uint8_t) {
+		if (watchpoint_count != 0 && watchpoints[address]) {
+			stop_pending = true;
+			pending_cause = StopCause::Watchpoint;
+			watch_hit = address;
+			active = true;
+		}
+	}
+	bool on_execute(const Chip8State& state) {
+		return active && should_stop(state);
+	}
+};
+
+// text views of a machine state, shared by tools/debug and the frontend
+// overlay; disassembly marks pc with '>' and breakpoints with '*'
+std::vector<std::string> format_registers(const Chip8State& state);
+std::string format_stack(const Chip8State& state);
+std::vector<std::string> format_memory(const Chip8State& state, std::uint16_t address, int rows);
+std::vector<std::string> format_disassembly(const Chip8State& state, std::uint16_t address, int lines, const Debugger& debugger);
+// one line per field of actual that is not as expected, at most limit of
+// them; display rows show which pixels differ
+std::vector<std::string> format_state_diff(const Chip8State& expected, const Chip8State& actual, int limit);
+const char* stop_cause_name(StopCause cause);
+#endif
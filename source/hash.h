@@ -0,0 +1,31 @@
+#ifndef HASH
+#define HASH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// 64-bit FNV-1a, fast enough to key ROMs and machine states by content
+inline std::uint64_t hash_bytes(const void* data, std::size_t size, std::uint64_t hash = 0xCBF29CE484222325ULL) {
+	const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+	for (std::size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+// eight bytes per step for buffers too big to hash a byte at a time, like
+// whole machine states; does not give the same values as hash_bytes
+inline std::uint64_t hash_words(const void* data, std::size_t size, std::uint64_t hash = 0xCBF29CE484222325ULL) {
+	const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+	std::size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		std::uint64_t word;
+		std::memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+		hash ^= hash >> 29;
+	}
+	return hash_bytes(bytes + i, size - i, hash);
+}
+#endif
@@ -10,18 +10,36 @@
 #include <SDL.h>
 #include <SDL_mixer.h>
 #include <SDL_ttf.h>
+#include <algorithm>
 #include <array>
+#include <cctype>
+#include <cmath>
+#include <csignal>
 #include <cstdint>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include "chip8.h"
+#include "debugger.h"
+#include "profiler.h"
+#include "romdb.h"
+#include "romlib.h"
+#include "thumbnails.h"
+#include "tracer.h"
 #include <string.h>
 #include <stdio.h>
 constexpr int WIDTH = 64;
 constexpr int HEIGHT = 32;
+constexpr int MAX_WIDTH = 128;  // super-chip high resolution
+constexpr int MAX_HEIGHT = 64;
 constexpr int SCALE = 10;
 constexpr int FPS = 60;
 constexpr int TICKS_PER_FRAME = 1000 / FPS;
-constexpr int INSTRUCTIONS_PER_STEP = 10;
+constexpr int RUN_AHEAD_FRAMES = 1;      // frames emulated speculatively, 0 disables
+constexpr int RUN_AHEAD_REPORT = 600;    // frames between snapshot timing reports
+constexpr int MENU_ROWS = 15;            // rom names visible in the picker
+constexpr int THUMBNAIL_FRAMES = 300;    // frames a rom runs before its preview is taken
+constexpr int THUMBNAIL_THREADS = 2;     // background preview workers
 
 constexpr std::array<SDL_Keycode, 16> keymap{
 	SDLK_x, SDLK_1, SDLK_2, SDLK_3,   // 0 1 2 3
@@ -29,6 +47,35 @@ constexpr std::array<SDL_Keycode, 16> keymap{
 	SDLK_s, SDLK_d, SDLK_z, SDLK_c,   // 8 9 A B
 	SDLK_4, SDLK_r, SDLK_f, SDLK_v };  // C D E F
 
+#ifdef __SWITCH__
+struct ButtonMapping {
+	u64 button;
+	int key;
+};
+
+constexpr std::array<ButtonMapping, 17> buttonmap{ {
+	{ KEY_DUP, 0x0 }, { KEY_DDOWN, 0x1 }, { KEY_DLEFT, 0x2 }, { KEY_DRIGHT, 0x3 },
+	{ KEY_A, 0x4 }, { KEY_B, 0x5 }, { KEY_Y, 0x6 }, { KEY_X, 0x7 }, { KEY_L, 0x7 },
+	{ KEY_R, 0x8 }, { KEY_ZL, 0x9 }, { KEY_ZR, 0xA },
+	{ KEY_LSTICK_LEFT, 0xB }, { KEY_LSTICK_UP, 0xC }, { KEY_LSTICK_RIGHT, 0xD },
+	{ KEY_LSTICK_DOWN, 0xE }, { KEY_RSTICK_DOWN, 0xF } } };
+#endif // SWITCH
+
+// a keypad change as it arrived from SDL or hid, before it is placed on a cycle
+struct TimedKey {
+	std::uint32_t ticks;
+	std::uint8_t key;
+	bool pressed;
+};
+
+void queue_key(std::vector<TimedKey>& queue, std::uint32_t ticks, int key, bool pressed) {
+	TimedKey timed;
+	timed.ticks = ticks;
+	timed.key = key;
+	timed.pressed = pressed;
+	queue.push_back(timed);
+}
+
 void sdl_error() {
 	std::cerr << "SDL has encountered an error: ";
 	std::cerr << SDL_GetError() << "\n";
@@ -78,6 +125,46 @@ private:
 	int mWidth;
 	int mHeight;
 };
+
+//Text renderer that rasterizes each glyph once and draws strings from a
+//single texture, so no texture is created while the menu is running
+class GlyphAtlas
+{
+public:
+	//Initializes variables
+	GlyphAtlas();
+
+	//Deallocates memory
+	~GlyphAtlas();
+
+	//Rasterizes the printable ASCII glyphs of a font into one texture
+	bool loadFromFont(TTF_Font* font);
+
+	//Deallocates texture
+	void free();
+
+	//Renders text with its top left corner at given point
+	void render(int x, int y, const std::string& text, SDL_Color color);
+
+	//Gets text dimensions
+	int getTextWidth(const std::string& text);
+	int getHeight();
+
+private:
+	static constexpr int FIRST_GLYPH = 32;
+	static constexpr int GLYPH_COUNT = 127 - FIRST_GLYPH;
+	static constexpr int ATLAS_WIDTH = 512;
+
+	//The texture holding every glyph
+	SDL_Texture* mTexture;
+
+	//Where each glyph sits in the texture and how far it moves the pen
+	std::array<SDL_Rect, GLYPH_COUNT> mGlyphs;
+	std::array<int, GLYPH_COUNT> mAdvances;
+
+	//Line height
+	int mHeight;
+};
 void init_sdl(SDL_Window*& window, SDL_Texture*& texture, SDL_Renderer*& renderer) {
 	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
 		sdl_error();
@@ -98,7 +185,7 @@ void init_sdl(SDL_Window*& window, SDL_Texture*& texture, SDL_Renderer*& rendere
 		sdl_error();
 	}
 
-	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, MAX_WIDTH, MAX_HEIGHT);
 	if (texture == nullptr) {
 		sdl_error();
 	}
@@ -132,34 +219,44 @@ void init_audio(Mix_Chunk*& chunk) {
 		exit(1);
 	}
 }
+// xo-chip roms play a 128 sample 1-bit loop at a rate set by their pitch,
+// rendered into one frame of audio whenever either changes
+Mix_Chunk* pattern_chunk(Chip8& chip8) {
+	static std::array<std::int16_t, 2 * 44100 / 60> samples;
+	static Mix_Chunk* patternChunk = nullptr;
+	static std::array<std::uint8_t, 16> lastPattern;
+	static int lastPitch = -1;
+	const std::array<std::uint8_t, 16>& pattern = chip8.get_audio_pattern();
+	if (patternChunk != nullptr && pattern == lastPattern && chip8.get_pitch() == lastPitch) {
+		return patternChunk;
+	}
+	lastPattern = pattern;
+	lastPitch = chip8.get_pitch();
+	double rate = 4000 * std::pow(2.0, (lastPitch - 64) / 48.0);
+	for (std::size_t i = 0; i < samples.size() / 2; i++) {
+		int bit = static_cast<int>(i * rate / 44100) % 128;
+		std::int16_t level = (pattern[bit / 8] >> (7 - bit % 8) & 1) ? 4000 : -4000;
+		samples[i * 2] = level;
+		samples[i * 2 + 1] = level;
+	}
+	if (patternChunk == nullptr) {
+		patternChunk = Mix_QuickLoad_RAW(reinterpret_cast<Uint8*>(samples.data()), sizeof(samples));
+	}
+	return patternChunk;
+}
 #ifdef __SWITCH__
-int getInd(char* curFile, int curIndex) {
-	DIR* dir;
-	struct dirent* ent;
-
-	if (curIndex < 0)
-		curIndex = 0;
-
-	dir = opendir("/roms/chip8");//Open current-working-directory.
-	if (dir == NULL)
-	{
-		sprintf(curFile, "Failed to open dir!");
-		return curIndex;
+// moves the selection to the first rom of the next or previous initial letter
+int jump_initial(const RomLibrary& library, int index, int direction) {
+	char initial = tolower(static_cast<unsigned char>(library.get(index).name[0]));
+	if (direction > 0) {
+		int next = library.lower_bound(std::string(1, initial + 1));
+		return next < library.size() ? next : index;
 	}
-	else
-	{
-		int i;
-		for (i = 0; i <= curIndex; i++) {
-			ent = readdir(dir);
-		}
-		if (ent)
-			sprintf(curFile, "/roms/chip8/%s", ent->d_name);
-		else
-			curIndex--;
-		closedir(dir);
+	int first = library.lower_bound(std::string(1, initial));
+	if (first < index || first == 0) {
+		return first;
 	}
-
-	return curIndex;
+	return library.lower_bound(std::string(1, tolower(static_cast<unsigned char>(library.get(first - 1).name[0]))));
 }
 #endif
 SDL_Window* window = nullptr;
@@ -169,8 +266,8 @@ Mix_Chunk* chunk = nullptr;
 //Globally used font
 TTF_Font *gFont = NULL;
 
-//Rendered texture
-LTexture gTextTexture;
+//Menu text
+GlyphAtlas gAtlas;
 LTexture::LTexture()
 {
 	//Initialize
@@ -275,6 +372,327 @@ int LTexture::getHeight()
 	return mHeight;
 }
 
+GlyphAtlas::GlyphAtlas()
+{
+	//Initialize
+	mTexture = NULL;
+	mHeight = 0;
+}
+
+GlyphAtlas::~GlyphAtlas()
+{
+	//Deallocate
+	free();
+}
+
+bool GlyphAtlas::loadFromFont(TTF_Font* font)
+{
+	//Get rid of preexisting texture
+	free();
+
+	//Render every glyph in white so color modulation can tint it later
+	SDL_Color white = { 0xFF, 0xFF, 0xFF, 0xFF };
+	std::array<SDL_Surface*, GLYPH_COUNT> surfaces;
+	int penX = 0;
+	int penY = 0;
+	int rowHeight = 0;
+	for (int i = 0; i < GLYPH_COUNT; i++)
+	{
+		int minx, maxx, miny, maxy;
+		surfaces[i] = TTF_RenderGlyph_Blended(font, FIRST_GLYPH + i, white);
+		if (surfaces[i] == NULL || TTF_GlyphMetrics(font, FIRST_GLYPH + i, &minx, &maxx, &miny, &maxy, &mAdvances[i]) < 0)
+		{
+			printf("Unable to render glyph %d! SDL_ttf Error: %s\n", FIRST_GLYPH + i, TTF_GetError());
+			mGlyphs[i] = { 0, 0, 0, 0 };
+			mAdvances[i] = 0;
+			continue;
+		}
+
+		//Pack glyphs left to right in rows
+		if (penX + surfaces[i]->w > ATLAS_WIDTH)
+		{
+			penX = 0;
+			penY += rowHeight;
+			rowHeight = 0;
+		}
+		mGlyphs[i] = { penX, penY, surfaces[i]->w, surfaces[i]->h };
+		penX += surfaces[i]->w;
+		rowHeight = std::max(rowHeight, surfaces[i]->h);
+	}
+	mHeight = TTF_FontHeight(font);
+
+	//Copy the glyphs into one surface, keeping their alpha
+	SDL_Surface* atlasSurface = SDL_CreateRGBSurfaceWithFormat(0, ATLAS_WIDTH, penY + rowHeight, 32, SDL_PIXELFORMAT_RGBA32);
+	if (atlasSurface == NULL)
+	{
+		printf("Unable to create glyph atlas surface! SDL Error: %s\n", SDL_GetError());
+	}
+	for (int i = 0; i < GLYPH_COUNT; i++)
+	{
+		if (surfaces[i] != NULL)
+		{
+			if (atlasSurface != NULL)
+			{
+				SDL_SetSurfaceBlendMode(surfaces[i], SDL_BLENDMODE_NONE);
+				SDL_BlitSurface(surfaces[i], NULL, atlasSurface, &mGlyphs[i]);
+			}
+			SDL_FreeSurface(surfaces[i]);
+		}
+	}
+	if (atlasSurface == NULL)
+	{
+		return false;
+	}
+
+	//Create texture from surface pixels
+	mTexture = SDL_CreateTextureFromSurface(renderer, atlasSurface);
+	if (mTexture == NULL)
+	{
+		printf("Unable to create glyph atlas texture! SDL Error: %s\n", SDL_GetError());
+	}
+	else
+	{
+		SDL_SetTextureBlendMode(mTexture, SDL_BLENDMODE_BLEND);
+	}
+	SDL_FreeSurface(atlasSurface);
+
+	//Return success
+	return mTexture != NULL;
+}
+
+void GlyphAtlas::free()
+{
+	//Free texture if it exists
+	if (mTexture != NULL)
+	{
+		SDL_DestroyTexture(mTexture);
+		mTexture = NULL;
+		mHeight = 0;
+	}
+}
+
+void GlyphAtlas::render(int x, int y, const std::string& text, SDL_Color color)
+{
+	//One color change per string, then one copy per glyph which the
+	//renderer batches into a single draw
+	SDL_SetTextureColorMod(mTexture, color.r, color.g, color.b);
+	for (char c : text)
+	{
+		int i = static_cast<unsigned char>(c) - FIRST_GLYPH;
+		if (i < 0 || i >= GLYPH_COUNT)
+		{
+			i = '?' - FIRST_GLYPH;
+		}
+		SDL_Rect renderQuad = { x, y, mGlyphs[i].w, mGlyphs[i].h };
+		SDL_RenderCopy(renderer, mTexture, &mGlyphs[i], &renderQuad);
+		x += mAdvances[i];
+	}
+}
+
+int GlyphAtlas::getTextWidth(const std::string& text)
+{
+	int width = 0;
+	for (char c : text)
+	{
+		int i = static_cast<unsigned char>(c) - FIRST_GLYPH;
+		width += mAdvances[(i < 0 || i >= GLYPH_COUNT) ? '?' - FIRST_GLYPH : i];
+	}
+	return width;
+}
+
+int GlyphAtlas::getHeight()
+{
+	return mHeight;
+}
+
+void present(Chip8& chip8, bool color, const std::vector<std::string>* overlay = nullptr) {
+	// the rom's own palette, or the green theme when toggled; the second
+	// xo-chip plane and pixels lit in both take octo's default colours
+	std::uint32_t palette[4] = {
+		chip8.get_settings().background,
+		color ? 0x64DC64FFu : chip8.get_settings().foreground,
+		0xFF6600FF,
+		0x662200FF
+	};
+	// only the part of the texture the current mode uses is written and shown
+	SDL_Rect area = { 0, 0, chip8.get_width(), chip8.get_height() };
+	std::uint32_t* pixels = nullptr;
+	int pitch;
+	SDL_LockTexture(texture, &area, reinterpret_cast<void**>(&pixels), &pitch);
+	for (int y = 0; y < area.h; y++) {
+		const std::uint64_t* row = chip8.get_row(y);
+		std::uint32_t* out = pixels + y * (pitch / sizeof(std::uint32_t));
+		for (int x = 0; x < area.w; x++) {
+			int shift = 63 - x % 64;
+			out[x] = palette[(row[x / 64] >> shift & 1) | (row[2 + x / 64] >> shift & 1) << 1];
+		}
+	}
+	SDL_UnlockTexture(texture);
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, texture, &area, nullptr);
+	if (overlay != nullptr) {
+		SDL_Color overlayColor = { 0xFF, 0xFF, 0x00, 0xFF };
+		for (std::size_t i = 0; i < overlay->size(); i++) {
+			gAtlas.render(4, static_cast<int>(i) * gAtlas.getHeight(), (*overlay)[i], overlayColor);
+		}
+	}
+	SDL_RenderPresent(renderer);
+}
+
+// the profiler, tracer and debugger are all observers and only one can be
+// attached at a time, so starting any of them stops the others
+struct Instruments {
+	Profiler profiler;
+	std::unique_ptr<Tracer> tracer;  // its ring is 8 MB, made on first use
+	Debugger debugger;
+	bool profiling = false;
+	bool tracing = false;
+	bool debugging = false;
+};
+
+// where a report for the running rom goes, named after its hash
+std::string instrument_path(Chip8& chip8, const char* kind) {
+	char name[48];
+#ifdef __SWITCH__
+	snprintf(name, sizeof(name), "/roms/chip8_%s_%016llx", kind, static_cast<unsigned long long>(chip8.get_rom_hash()));
+#else
+	snprintf(name, sizeof(name), "chip8_%s_%016llx", kind, static_cast<unsigned long long>(chip8.get_rom_hash()));
+#endif // SWITCH
+	return name;
+}
+
+// attaches whichever instrument is running, or none
+void attach_instruments(Chip8& chip8, Instruments& instruments) {
+	if (instruments.debugging) {
+		chip8.set_observer(&instruments.debugger);
+	}
+	else if (instruments.profiling) {
+		chip8.set_observer(&instruments.profiler);
+	}
+	else if (instruments.tracing) {
+		chip8.set_observer(instruments.tracer.get());
+	}
+	else {
+		chip8.clear_observer();
+	}
+}
+
+// a crash while tracing still leaves the trace behind; the path is kept in
+// a fixed buffer and dumped with plain open and write, nothing in the
+// handler allocates
+Tracer* crash_tracer = nullptr;
+std::uint64_t crash_hash = 0;
+char crash_path[64];
+
+void dump_trace_on_crash(int sig) {
+	if (crash_tracer != nullptr) {
+		crash_tracer->dump(crash_path, crash_hash);
+	}
+	std::signal(sig, SIG_DFL);
+	std::raise(sig);
+}
+
+void toggle_tracer(Chip8& chip8, Instruments& instruments);
+void toggle_debugger(Chip8& chip8, Instruments& instruments);
+
+// writes <path>.json with the heatmap and <path>.folded for flame graphs
+void toggle_profiler(Chip8& chip8, Instruments& instruments) {
+	if (instruments.tracing) {
+		toggle_tracer(chip8, instruments);
+	}
+	if (instruments.debugging) {
+		toggle_debugger(chip8, instruments);
+	}
+	instruments.profiling = !instruments.profiling;
+	if (instruments.profiling) {
+		instruments.profiler.reset();
+		attach_instruments(chip8, instruments);
+		printf("profiler: started\n");
+		return;
+	}
+	attach_instruments(chip8, instruments);
+	std::string base = instrument_path(chip8, "profile");
+	bool written = instruments.profiler.write_json(base + ".json") && instruments.profiler.write_folded(base + ".folded");
+	printf("profiler: %s %s.json\n", written ? "wrote" : "could not write", base.c_str());
+}
+
+// writes <path>.trace with the last million instructions, see tools/tracedump
+void toggle_tracer(Chip8& chip8, Instruments& instruments) {
+	if (instruments.profiling) {
+		toggle_profiler(chip8, instruments);
+	}
+	if (instruments.debugging) {
+		toggle_debugger(chip8, instruments);
+	}
+	instruments.tracing = !instruments.tracing;
+	std::string path = instrument_path(chip8, "trace") + ".trace";
+	if (instruments.tracing) {
+		if (!instruments.tracer) {
+			instruments.tracer.reset(new Tracer());
+		}
+		instruments.tracer->reset();
+		attach_instruments(chip8, instruments);
+		snprintf(crash_path, sizeof(crash_path), "%s", path.c_str());
+		crash_hash = chip8.get_rom_hash();
+		crash_tracer = instruments.tracer.get();
+		printf("tracer: started\n");
+		return;
+	}
+	crash_tracer = nullptr;
+	attach_instruments(chip8, instruments);
+	bool written = instruments.tracer->dump(path, chip8.get_rom_hash());
+	printf("tracer: %s %s\n", written ? "wrote" : "could not write", path.c_str());
+}
+
+// opening the debugger stops the rom where it is, closing it lets it run on
+void toggle_debugger(Chip8& chip8, Instruments& instruments) {
+	if (instruments.profiling) {
+		toggle_profiler(chip8, instruments);
+	}
+	if (instruments.tracing) {
+		toggle_tracer(chip8, instruments);
+	}
+	instruments.debugging = !instruments.debugging;
+	if (instruments.debugging) {
+#ifndef __SWITCH__
+		// the desktop build has no menu, so the font is only needed here
+		if (gFont == NULL) {
+			gFont = TTF_OpenFont("romfs/lazy.ttf", 16);
+			gAtlas.loadFromFont(gFont);
+		}
+#endif // SWITCH
+		attach_instruments(chip8, instruments);
+		instruments.debugger.pause(chip8);
+		return;
+	}
+	instruments.debugger.resume(chip8);
+	attach_instruments(chip8, instruments);
+}
+
+// the debugger's view of the real machine, drawn over the screen
+std::vector<std::string> debugger_overlay(Chip8& chip8, const Debugger& debugger) {
+	static Chip8State state;  // 64 KB, kept off the stack
+	chip8.save_state(state);
+	std::string status = chip8.get_halt_reason() == HaltReason::Break ? stop_cause_name(debugger.get_stop_cause())
+		: halt_reason_name(chip8.get_halt_reason());
+#ifdef __SWITCH__
+	std::vector<std::string> lines = { "debug: " + status + "   RS up close, right step, left over" };
+#else
+	std::vector<std::string> lines = { "debug: " + status + "   F5 run/pause F6 step F7 over F8 break" };
+#endif // SWITCH
+	for (const std::string& line : format_registers(state)) {
+		lines.push_back(line);
+	}
+	lines.push_back(format_stack(state));
+	for (const std::string& line : format_disassembly(state, state.pc >= 4 ? state.pc - 4 : 0, 6, debugger)) {
+		lines.push_back(line);
+	}
+	for (const std::string& line : format_memory(state, state.I, 2)) {
+		lines.push_back(line);
+	}
+	return lines;
+}
+
 int main(int argc, char* argv[]) {
 #ifdef __SWITCH__
 	romfsInit();
@@ -288,6 +706,9 @@ int main(int argc, char* argv[]) {
 	if (stat("sdmc:/roms/chip8", &st) == -1) {
 		mkdir("sdmc:/roms/chip8", 0777);
 	}
+	if (stat("sdmc:/roms/chip8_thumbs", &st) == -1) {
+		mkdir("sdmc:/roms/chip8_thumbs", 0777);
+	}
 #endif 
 	
 	SDL_Event event;
@@ -295,20 +716,49 @@ int main(int argc, char* argv[]) {
 	init_sdl(window, texture, renderer);
 	init_audio(chunk);
 	TTF_Init();
-	Chip8 chip8;
+	// 64 KB of memory each, kept off the stack
+	static Chip8 chip8;
+	RomDatabase database;
+#ifdef __SWITCH__
+	database.load("/roms/chip8_settings.bin");
+#else
+	database.load("chip8_settings.bin");
+#endif // SWITCH
+	chip8.set_database(&database);
 	SDL_Color textColor = { 0, 0, 0 };
 	bool quit2 = false;
 #ifdef __SWITCH__
 	gFont = TTF_OpenFont("romfs:/lazy.ttf", 28);
+	gAtlas.loadFromFont(gFont);
+	SDL_Color fadedColor = { 0x90, 0x90, 0x90 };
+	const std::string menuHelp = "Select Rom with DPad, L/R to jump by letter.";
+	RomLibrary library;
+	library.open("/roms/chip8", "/roms/chip8_library.bin");
 	int curIndex = 0;
-	char curFile[255];
-	curIndex = getInd(curFile, curIndex);
+	std::string curFile = library.size() > 0 ? library.get(curIndex).name : "No roms found in /roms/chip8";
+
+	// previews are generated in the background and shown once they exist
+	ThumbnailCache thumbnails("/roms/chip8_thumbs", THUMBNAIL_FRAMES, &database, THUMBNAIL_THREADS);
+	SDL_Texture* thumbTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+	Thumbnail thumbnail;
+	bool haveThumbnail = false;
 	
+	// the picker redraws only when its state changes and otherwise sleeps
+	// until the next input poll; built with -DMENU_STATS the time it spends
+	// awake is reported once per second over nxlink
+	bool redraw = true;
+#ifdef MENU_STATS
+	std::uint64_t menuBusy = 0;
+	int menuRedraws = 0;
+	std::uint32_t menuReport = SDL_GetTicks();
+#endif
+
 	bool quit = false;
 	while (!quit && appletMainLoop())
 	{
-
-		
+#ifdef MENU_STATS
+		std::uint64_t wake = SDL_GetPerformanceCounter();
+#endif
 
 		hidScanInput();
 
@@ -322,26 +772,50 @@ int main(int argc, char* argv[]) {
 
 		
 
-		if (kDown & KEY_DOWN || kDown & KEY_DDOWN) {
-			
-			
-			curIndex++;
-			curIndex = getInd(curFile, curIndex);
-			printf("\x1b[18;10H%s", curFile);
-}
+		if (library.size() > 0) {
+			int lastIndex = curIndex;
+			if (kDown & KEY_DOWN || kDown & KEY_DDOWN) {
+				curIndex = std::min(curIndex + 1, library.size() - 1);
+			}
+			if (kDown & KEY_UP || kDown & KEY_DUP) {
+				curIndex = std::max(curIndex - 1, 0);
+			}
+			if (kDown & KEY_R) {
+				curIndex = jump_initial(library, curIndex, 1);
+			}
+			if (kDown & KEY_L) {
+				curIndex = jump_initial(library, curIndex, -1);
+			}
+			if (curIndex != lastIndex) {
+				curFile = library.get(curIndex).name;
+				printf("\x1b[18;10H%s", curFile.c_str());
+				redraw = true;
+				haveThumbnail = false;
+			}
 
-		if (kDown & KEY_UP || kDown & KEY_DUP) {
-		
-		
-			curIndex--;
-			curIndex = getInd(curFile, curIndex);
-			printf("\x1b[18;10H%s", curFile);
-		}
+			//Pick up the preview as soon as a worker finishes it, and queue
+			//the neighbours so scrolling finds them ready
+			if (!haveThumbnail && thumbnails.get(library.get(curIndex).hash, library.path(curIndex), thumbnail)) {
+				haveThumbnail = true;
+				redraw = true;
+				std::uint32_t thumbPixels[WIDTH * HEIGHT];
+				for (int i = 0; i < WIDTH * HEIGHT; i++) {
+					thumbPixels[i] = (thumbnail.pixels[i / 8] & (0x80 >> (i % 8))) ? 0xFFFFFFFF : 0x000000FF;
+				}
+				SDL_UpdateTexture(thumbTexture, nullptr, thumbPixels, WIDTH * sizeof(std::uint32_t));
+				for (int near = curIndex - 2; near <= curIndex + 2; near++) {
+					if (near >= 0 && near < library.size()) {
+						Thumbnail ignored;
+						thumbnails.get(library.get(near).hash, library.path(near), ignored);
+					}
+				}
+			}
 
-		if (kDown & KEY_A)
-		{
-			quit = true;
-			chip8.load_rom(curFile);
+			if (kDown & KEY_A)
+			{
+				quit = true;
+				chip8.load_rom(library.path(curIndex));
+			}
 		}
 		if (kDown & KEY_PLUS)
 		{
@@ -349,23 +823,70 @@ int main(int argc, char* argv[]) {
 			quit2 = true;
 		}
 
-		//Clear screen
-		SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
-		SDL_RenderClear(renderer);
+		if (!redraw)
+		{
+			//Nothing changed, so sleep instead of redrawing the same frame
+#ifdef MENU_STATS
+			menuBusy += SDL_GetPerformanceCounter() - wake;
+#endif
+			SDL_Delay(TICKS_PER_FRAME);
+		}
+		else
+		{
+			//Clear screen
+			SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
+			SDL_RenderClear(renderer);
 		
-		gTextTexture.loadFromRenderedText(curFile, textColor);
+			//Render the entries around the selection, highlighting it
+			int lineHeight = gAtlas.getHeight() + 4;
+			int listY = (720 - gAtlas.getHeight()) / 2;
+			for (int row = -MENU_ROWS / 2; row <= MENU_ROWS / 2; row++)
+			{
+				int entry = curIndex + row;
+				if (entry < 0 || entry >= library.size())
+				{
+					continue;
+				}
+				const std::string& name = (row == 0) ? curFile : library.get(entry).name;
+				SDL_Color rowColor = (row == 0) ? textColor : fadedColor;
+				gAtlas.render((1280 - gAtlas.getTextWidth(name)) / 2, listY + row * lineHeight, name, rowColor);
+			}
+			if (library.size() == 0)
+			{
+				gAtlas.render((1280 - gAtlas.getTextWidth(curFile)) / 2, listY, curFile, textColor);
+			}
+
+			gAtlas.render((1280 - gAtlas.getTextWidth(menuHelp)) / 2, 60, menuHelp, textColor);
+			if (haveThumbnail)
+			{
+				SDL_Rect thumbQuad = { 1280 - WIDTH * 4 - 40, 40, WIDTH * 4, HEIGHT * 4 };
+				SDL_RenderCopy(renderer, thumbTexture, nullptr, &thumbQuad);
+			}
+#ifdef MENU_STATS
+			menuBusy += SDL_GetPerformanceCounter() - wake;
+			menuRedraws++;
+#endif
+			redraw = false;
 
-		//Render current frame
-		gTextTexture.render((1280 - gTextTexture.getWidth()) / 2, (720 - gTextTexture.getHeight()) / 2);
-		gTextTexture.loadFromRenderedText("Select Rom with DPad.", textColor);
+			//Update screen
+			SDL_RenderPresent(renderer);
+		}
 
-		//Render current frame
-		gTextTexture.render((1280 - gTextTexture.getWidth()) / 2, (720 - gTextTexture.getHeight()) / 2 - 30);
-		//Update screen
-		SDL_RenderPresent(renderer);
+#ifdef MENU_STATS
+		if (SDL_GetTicks() - menuReport >= 1000)
+		{
+			printf("menu: %.2f ms awake/s, %d redraws/s\n", menuBusy * 1000.0 / SDL_GetPerformanceFrequency(), menuRedraws);
+			menuBusy = 0;
+			menuRedraws = 0;
+			menuReport = SDL_GetTicks();
+		}
+#endif
 		}
 	
 
+	// leave the workers idle while a game runs
+	thumbnails.cancel_pending();
+	SDL_DestroyTexture(thumbTexture);
 #else
 	chip8.load_rom("C:\\respaldo2017\\C++\\Chip8\\Debug\\PONG2");
 
@@ -374,6 +895,24 @@ int main(int argc, char* argv[]) {
 	std::uint32_t delta_time;
 	
 	bool color = false;
+
+	// run-ahead: each frame the real state is saved, emulated a few frames
+	// into the future with the current input, presented, then rolled back
+	static Chip8State snapshot;
+	std::uint64_t snapshot_ticks = 0;
+	int snapshot_frames = 0;
+
+	// off by default, the interpreter only takes the observed loop while one is attached
+	static Instruments instruments;
+	std::signal(SIGSEGV, dump_trace_on_crash);
+	std::signal(SIGABRT, dump_trace_on_crash);
+	std::signal(SIGFPE, dump_trace_on_crash);
+
+	// input is stamped on arrival and replayed at the matching cycle
+	std::vector<TimedKey> key_events;
+	std::vector<KeyEvent> frame_events;
+	std::uint32_t last_frame_time = SDL_GetTicks();
+	HaltReason reported_halt = HaltReason::None;
 #ifdef __SWITCH__
 	while (appletMainLoop() && !quit2)
 #else
@@ -400,162 +939,184 @@ int main(int argc, char* argv[]) {
 		if (kDown & KEY_MINUS) {
 			color = !color;
 		}
-		if (kDown & KEY_DUP) {
-			chip8.press_key(0);
-		}
-		if (kUp & KEY_DUP) {
-			chip8.release_key(0);
-		}
-
-		if (kDown & KEY_DDOWN) {
-			chip8.press_key(1);
-		}
-		if (kUp & KEY_DDOWN) {
-			chip8.release_key(1);
-		}
-		if (kDown & KEY_DLEFT) {
-			chip8.press_key(2);
-		}
-		if (kUp & KEY_DLEFT) {
-			chip8.release_key(2);
-		}
-		if (kDown & KEY_DRIGHT) {
-			chip8.press_key(3);
-		}
-		if (kUp & KEY_DRIGHT) {
-			chip8.release_key(3);
-		}
-		if (kDown & KEY_A) {
-			chip8.press_key(4);
-		}
-		if (kUp & KEY_A) {
-			chip8.release_key(4);
-		}
-		if (kDown & KEY_B) {
-			chip8.press_key(5);
-		}
-		if (kUp & KEY_B) {
-			chip8.release_key(5);
-		}
-		if (kDown & KEY_Y) {
-			chip8.press_key(6);
-	}
-		if (kUp & KEY_Y) {
-			chip8.release_key(6);
-		}
-		if (kDown & KEY_X) {
-			chip8.press_key(7);
-		}
-		if (kUp & KEY_X) {
-			chip8.release_key(7);
-		}
-		if (kDown & KEY_L) {
-			chip8.press_key(7);
-	}
-		if (kUp & KEY_L) {
-			chip8.release_key(7);
-		}
-		if (kDown & KEY_R) {
-			chip8.press_key(8);
-		}
-		if (kUp & KEY_R) {
-			chip8.release_key(8);
-		}
-		if (kDown & KEY_ZL) {
-			chip8.press_key(9);
-	}
-		if (kUp & KEY_ZL) {
-			chip8.release_key(9);
-		}
-		if (kDown & KEY_ZR) {
-			chip8.press_key(10);
-		}
-		if (kUp & KEY_ZR) {
-			chip8.release_key(10);
-		}
-		if (kDown & KEY_LSTICK_LEFT) {
-			chip8.press_key(11);
-	}
-		if (kUp & KEY_LSTICK_LEFT) {
-			chip8.release_key(11);
-		}
-		if (kDown & KEY_LSTICK_UP) {
-			chip8.press_key(12);
-		}
-		if (kUp & KEY_LSTICK_UP) {
-			chip8.release_key(12);
-		}
-		if (kDown & KEY_LSTICK_RIGHT) {
-			chip8.press_key(13);
+		if (kDown & KEY_RSTICK) {
+			toggle_profiler(chip8, instruments);
 		}
-		if (kUp & KEY_LSTICK_RIGHT) {
-			chip8.release_key(13);
+		if (kDown & KEY_LSTICK) {
+			toggle_tracer(chip8, instruments);
 		}
-		if (kDown & KEY_LSTICK_DOWN) {
-			chip8.press_key(14);
+		if (kDown & KEY_RSTICK_UP) {
+			toggle_debugger(chip8, instruments);
 		}
-		if (kUp & KEY_LSTICK_DOWN) {
-			chip8.release_key(14);
+		if (instruments.debugging && (kDown & KEY_RSTICK_RIGHT)) {
+			instruments.debugger.step(chip8);
 		}
-		if (kDown & KEY_RSTICK_DOWN) {
-			chip8.press_key(15);
+		if (instruments.debugging && (kDown & KEY_RSTICK_LEFT)) {
+			instruments.debugger.step_over(chip8);
 		}
-		if (kUp & KEY_RSTICK_DOWN) {
-			chip8.release_key(15);
+		// hid only reports changes per scan, so they land at the start of the frame
+		for (const ButtonMapping& mapping : buttonmap) {
+			if (kDown & mapping.button) {
+				queue_key(key_events, last_frame_time, chip8.get_settings().keymap[mapping.key], true);
+			}
+			if (kUp & mapping.button) {
+				queue_key(key_events, last_frame_time, chip8.get_settings().keymap[mapping.key], false);
+			}
 		}
 
 #endif // SWITCH
 	
 
 		start_time = SDL_GetTicks();
-		for (int i = 0; i < INSTRUCTIONS_PER_STEP; i++) {
-			chip8.emulate_cycle();
-		}
 		while (SDL_PollEvent(&event)) {
 			switch (event.type) {
 			case SDL_QUIT:
 				quit2 = true;
 				break;
 			case SDL_KEYDOWN:
-				for (int i = 0; i < keymap.size(); i++) {
-					if (event.key.keysym.sym == keymap[i]) {
-						chip8.press_key(i);
+			case SDL_KEYUP:
+				if (event.key.repeat) {
+					break;
+				}
+				if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F9) {
+					toggle_profiler(chip8, instruments);
+					break;
+				}
+				if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F10) {
+					toggle_tracer(chip8, instruments);
+					break;
+				}
+				if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F11) {
+					toggle_debugger(chip8, instruments);
+					break;
+				}
+				if (instruments.debugging && event.type == SDL_KEYDOWN) {
+					Debugger& debugger = instruments.debugger;
+					switch (event.key.keysym.sym) {
+					case SDLK_F5:
+						if (chip8.get_halt_reason() == HaltReason::None) {
+							debugger.pause(chip8);
+						}
+						else {
+							debugger.resume(chip8);
+						}
+						break;
+					case SDLK_F6:
+						debugger.step(chip8);
+						break;
+					case SDLK_F7:
+						debugger.step_over(chip8);
+						break;
+					case SDLK_F8:
+						debugger.set_breakpoint(chip8.get_pc(), !debugger.has_breakpoint(chip8.get_pc()));
+						break;
 					}
 				}
-				break;
-			case SDL_KEYUP:
 				for (int i = 0; i < keymap.size(); i++) {
 					if (event.key.keysym.sym == keymap[i]) {
-						chip8.release_key(i);
+						queue_key(key_events, event.key.timestamp, chip8.get_settings().keymap[i], event.type == SDL_KEYDOWN);
 					}
 				}
 				break;
 			}
 		}
 
+		// stopped in the debugger nothing runs, only the overlay is redrawn
+		if (instruments.debugging && chip8.get_halt_reason() != HaltReason::None) {
+			std::vector<std::string> overlay = debugger_overlay(chip8, instruments.debugger);
+			present(chip8, color, &overlay);
+			// keys still change the keypad, one held when the machine stopped
+			// and let go meanwhile is not left pressed after resuming
+			for (const TimedKey& timed : key_events) {
+				timed.pressed ? chip8.press_key(timed.key) : chip8.release_key(timed.key);
+			}
+			key_events.clear();
+			last_frame_time = start_time;
+			SDL_Delay(TICKS_PER_FRAME);
+			continue;
+		}
+
+		// spread the input gathered since the last frame over this frame's
+		// instructions in proportion to when it arrived, so key timing does
+		// not depend on where in the frame the events happened to be polled
+		int instructions = chip8.get_settings().instructions_per_frame;
+		int expected = chip8.get_frame_instructions();  // the last frame's count when cycle timed
+		std::uint32_t frame_ticks = start_time - last_frame_time;
+		std::uint64_t base_cycle = chip8.get_cycles();
+		frame_events.clear();
+		for (const TimedKey& timed : key_events) {
+			std::uint32_t offset = timed.ticks - last_frame_time;
+			if (offset > frame_ticks) {  // stamped before the window started
+				offset = 0;
+			}
+			KeyEvent key_event;
+			key_event.cycle = base_cycle + (frame_ticks == 0 ? 0 : offset * expected / frame_ticks);
+			key_event.key = timed.key;
+			key_event.pressed = timed.pressed;
+			frame_events.push_back(key_event);
+		}
+		std::stable_sort(frame_events.begin(), frame_events.end(), [](const KeyEvent& a, const KeyEvent& b) {
+			return a.cycle < b.cycle;
+		});
+		key_events.clear();
+		last_frame_time = start_time;
+
+		chip8.run_frame(instructions, frame_events.data(), frame_events.size());
+
+		// a fault halts the machine instead of logging every cycle, say so once
+		if (chip8.get_halt_reason() != reported_halt) {
+			reported_halt = chip8.get_halt_reason();
+			if (reported_halt != HaltReason::None && reported_halt != HaltReason::Break) {
+				printf("halted: %s at %03X\n", halt_reason_name(reported_halt), chip8.get_pc());
+			}
+		}
+
 		if (chip8.get_sound_timer() > 0) {
-			Mix_PlayChannel(-1, chunk, 0);
+			Mix_PlayChannel(-1, chip8.has_audio_pattern() ? pattern_chunk(chip8) : chunk, 0);
+		}
+
+		// a running rom under the debugger shows its state every frame
+		std::vector<std::string> overlay;
+		if (instruments.debugging) {
+			overlay = debugger_overlay(chip8, instruments.debugger);
 		}
+		const std::vector<std::string>* shown = instruments.debugging ? &overlay : nullptr;
+
+		if (RUN_AHEAD_FRAMES > 0) {
+			bool drawn = chip8.get_draw_flag() || shown != nullptr;
+			std::uint64_t begin = SDL_GetPerformanceCounter();
+			chip8.save_state(snapshot);
+			snapshot_ticks += SDL_GetPerformanceCounter() - begin;
 
-		if (chip8.get_draw_flag()) {
+			// speculative frames are rolled back, so they stay out of the
+			// profile and the trace
+			chip8.clear_observer();
+			for (int i = 0; i < RUN_AHEAD_FRAMES; i++) {
+				chip8.run_frame(instructions);
+			}
+			attach_instruments(chip8, instruments);
+			if (drawn || chip8.get_draw_flag()) {
+				present(chip8, color, shown);
+			}
+
+			begin = SDL_GetPerformanceCounter();
+			chip8.load_state(snapshot);
+			snapshot_ticks += SDL_GetPerformanceCounter() - begin;
 			chip8.reset_draw_flag();
-			std::uint32_t* pixels = nullptr;
-			int pitch;
-			SDL_LockTexture(texture, nullptr, reinterpret_cast<void**>(&pixels), &pitch);
-			for (int i = 0; i < WIDTH * HEIGHT; i++) {
-				if (color == false)
-				pixels[i] = (chip8.get_pixel_data(i) == 0) ? 0x000000FF : 0xFFFFFFFF;
-				else
-					pixels[i] = (chip8.get_pixel_data(i) == 0) ? 0x000000FF : 0x64DC64FF;
+
+			if (++snapshot_frames == RUN_AHEAD_REPORT) {
+				printf("run-ahead: save+restore %.2f us/frame\n",
+					snapshot_ticks * 1000000.0 / SDL_GetPerformanceFrequency() / snapshot_frames);
+				snapshot_ticks = 0;
+				snapshot_frames = 0;
 			}
-			SDL_UnlockTexture(texture);
-			SDL_RenderClear(renderer);
-			SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-			SDL_RenderPresent(renderer);
+		}
+		else if (chip8.get_draw_flag() || shown != nullptr) {
+			chip8.reset_draw_flag();
+			present(chip8, color, shown);
 		}
 		delta_time = SDL_GetTicks() - start_time;
 		if (TICKS_PER_FRAME > delta_time) {
-			chip8.step_timers();
 			SDL_Delay(TICKS_PER_FRAME - delta_time);
 		}
 	}
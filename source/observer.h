@@ -0,0 +1,22 @@
+#ifndef OBSERVER
+#define OBSERVER
+
+#include <cstdint>
+
+struct Chip8State;
+
+// hooks Chip8 calls while it runs; an observer derives from NullObserver and
+// hides the hooks it wants, the interpreter is compiled once per observer so
+// the empty defaults inline away and an unobserved run pays nothing; idle
+// loops are only skipped while unobserved, observers see every instruction
+struct NullObserver {
+	void on_fetch(std::uint16_t address, std::uint16_t opcode, std::uint64_t cycles) {}  // cycles includes this one
+	bool on_execute(const Chip8State& state) { return false; }                          // after the instruction ran, true halts
+	void on_mem_write(std::uint16_t address, std::uint8_t value) {}                     // before the byte changes
+	void on_draw_begin() {}
+	void on_draw(std::uint8_t x, std::uint8_t y, int rows) {}
+	void on_undefined_opcode(std::uint16_t address, std::uint16_t opcode) {}
+	void on_frame_begin(std::uint64_t cycles) {}
+	void on_frame(std::uint64_t cycles) {}                                               // after the timers step
+};
+#endif
@@ -0,0 +1,177 @@
+#include "profiler.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr int MAX_DEPTH = 16;  // as deep as the chip-8 stack goes
+
+// reading the clock costs about as much as a small sprite, so one draw in
+// this many is timed and stands for the others
+constexpr int DRAW_SAMPLE = 16;
+}
+
+Profiler::Profiler() {
+	reset();
+}
+
+void Profiler::reset() {
+	heat.assign(65536, 0);
+	opcodes.assign(65536, 0);
+	nodes.assign(1, StackNode{ 0, 0x200, 0, 0 });
+	node_counts.assign(1, 0);
+	children.clear();
+	current = 0;
+	current_since = 0;
+	frames.clear();
+	frame = Frame{};
+	timing_draw = false;
+}
+
+void Profiler::on_frame_begin(std::uint64_t cycles) {
+	frame = Frame{};
+	frame_cycles = cycles;
+	if (frames.empty()) {
+		current_since = cycles;
+	}
+	frame_start = Clock::now();
+}
+
+void Profiler::on_frame(std::uint64_t cycles) {
+	frame.frame_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - frame_start).count();
+	frame.instructions = cycles - frame_cycles;
+	frames.push_back(frame);
+	node_counts[current] += cycles - current_since;
+	current_since = cycles;
+}
+
+void Profiler::on_draw_begin() {
+	timing_draw = frame.draws++ % DRAW_SAMPLE == 0;
+	if (timing_draw) {
+		draw_start = Clock::now();
+	}
+}
+
+void Profiler::on_draw(std::uint8_t, std::uint8_t, int) {
+	if (timing_draw) {
+		frame.draw_ns += DRAW_SAMPLE * std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - draw_start).count();
+	}
+}
+
+void Profiler::call(std::uint16_t address, std::uint64_t cycles) {
+	// roms that leave subroutines by jumping never return, past the chip-8
+	// stack depth the deepest stack keeps the time
+	if (nodes[current].depth == MAX_DEPTH) {
+		return;
+	}
+	node_counts[current] += cycles - current_since;  // the call itself is the caller's
+	current_since = cycles;
+	int last = nodes[current].last_child;
+	if (last != 0 && nodes[last].address == address) {
+		current = last;
+		return;
+	}
+	int caller = current;
+	std::uint64_t key = std::uint64_t(current) << 16 | address;
+	auto found = children.find(key);
+	if (found != children.end()) {
+		current = found->second;
+	}
+	else {
+		nodes.push_back(StackNode{ current, address, nodes[current].depth + 1, 0 });
+		node_counts.push_back(0);
+		current = nodes.size() - 1;
+		children[key] = current;
+	}
+	nodes[caller].last_child = current;
+}
+
+void Profiler::leave(std::uint64_t cycles) {
+	if (current == 0) {
+		return;
+	}
+	node_counts[current] += cycles - current_since;  // the return belongs to the callee
+	current_since = cycles;
+	current = nodes[current].parent;
+}
+
+std::string Profiler::class_name(int opcode_class) {
+	static const char* const patterns[16] = { "00%02X", "1nnn", "2nnn", "3xkk", "4xkk", "5xy%X", "6xkk", "7xkk",
+		"8xy%X", "9xy%X", "Annn", "Bnnn", "Cxkk", "Dxyn", "Ex%02X", "Fx%02X" };
+	char name[8];
+	snprintf(name, sizeof(name), patterns[opcode_class >> 8], opcode_class & 0xFF);
+	return name;
+}
+
+std::string Profiler::stack_name(int node) const {
+	std::string name;
+	for (; node != 0; node = nodes[node].parent) {
+		char frame_name[16];
+		snprintf(frame_name, sizeof(frame_name), ";sub_%03X", nodes[node].address);
+		name.insert(0, frame_name);
+	}
+	return "main" + name;
+}
+
+bool Profiler::write_json(const std::string& path) const {
+	std::ofstream file(path, std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+	std::uint64_t instructions = 0, draw_ns = 0, frame_ns = 0;
+	for (const Frame& f : frames) {
+		instructions += f.instructions;
+		draw_ns += f.draw_ns;
+		frame_ns += f.frame_ns;
+	}
+	file << "{\n  \"frames\": " << frames.size() << ",\n  \"instructions\": " << instructions
+		<< ",\n  \"frame_ns\": " << frame_ns << ",\n  \"draw_ns\": " << draw_ns << ",\n";
+
+	// only addresses that ran, as [address, count] pairs
+	file << "  \"heatmap\": [";
+	const char* separator = "";
+	for (std::size_t address = 0; address < heat.size(); address++) {
+		if (heat[address] != 0) {
+			file << separator << "[" << address << ", " << heat[address] << "]";
+			separator = ", ";
+		}
+	}
+	std::vector<std::uint64_t> classes(4096, 0);
+	for (std::size_t address = 0; address < heat.size(); address++) {
+		classes[opcode_class(opcodes[address])] += heat[address];
+	}
+	file << "],\n  \"opcodes\": {";
+	separator = "";
+	for (std::size_t i = 0; i < classes.size(); i++) {
+		if (classes[i] != 0) {
+			file << separator << "\"" << class_name(i) << "\": " << classes[i];
+			separator = ", ";
+		}
+	}
+	file << "},\n  \"per_frame\": [";
+	separator = "";
+	for (const Frame& f : frames) {
+		file << separator << "{\"instructions\": " << f.instructions << ", \"draws\": " << f.draws
+			<< ", \"frame_ns\": " << f.frame_ns << ", \"draw_ns\": " << f.draw_ns << "}";
+		separator = ",\n    ";
+	}
+	file << "]\n}\n";
+	return static_cast<bool>(file);
+}
+
+bool Profiler::write_folded(const std::string& path) const {
+	// one "main;sub_2A0;sub_300 count" line per stack, the format
+	// flamegraph.pl and speedscope read
+	std::ofstream file(path, std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+	for (std::size_t node = 0; node < nodes.size(); node++) {
+		if (node_counts[node] != 0) {
+			file << stack_name(node) << " " << node_counts[node] << "\n";
+		}
+	}
+	return static_cast<bool>(file);
+}
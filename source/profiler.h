@@ -0,0 +1,87 @@
+#ifndef PROFILER
+#define PROFILER
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "observer.h"
+
+// collects where a rom spends its time while attached to a Chip8 as its
+// observer: executions per address, per opcode class and per call stack, and
+// what every frame cost
+class Profiler : public NullObserver {
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Frame {
+		std::uint32_t instructions;
+		std::uint32_t draws;
+		std::uint32_t frame_ns;
+		std::uint32_t draw_ns;
+	};
+
+	// a call stack is a node whose parents lead back to the top level, node 0
+	struct StackNode {
+		int parent;
+		std::uint16_t address;
+		int depth;
+		int last_child;  // the most recent call from here, checked before the map
+	};
+
+	std::vector<std::uint32_t> heat;           // executions per address
+	std::vector<std::uint16_t> opcodes;        // instruction first seen at each address
+	std::vector<StackNode> nodes;
+	std::vector<std::uint64_t> node_counts;    // instructions run with the node on top
+	std::unordered_map<std::uint64_t, int> children;
+	int current;
+	std::uint64_t current_since;               // cycle count when current went on top
+	std::uint64_t frame_cycles;                // cycle count when the frame began
+	std::vector<Frame> frames;
+	Frame frame;
+	Clock::time_point frame_start;
+	Clock::time_point draw_start;
+	bool timing_draw;
+
+	void call(std::uint16_t address, std::uint64_t cycles);
+	void leave(std::uint64_t cycles);
+	std::string stack_name(int node) const;
+
+public:
+	Profiler();
+	void reset();
+
+	// observer hooks; instructions per frame and per stack are taken from
+	// the cycle count when they change, keeping the per instruction work to
+	// two counters
+	void on_frame_begin(std::uint64_t cycles);
+	void on_frame(std::uint64_t cycles);
+	void on_draw_begin();
+	void on_draw(std::uint8_t x, std::uint8_t y, int rows);
+	void on_fetch(std::uint16_t address, std::uint16_t opcode, std::uint64_t cycles) {
+		// the opcode histogram is built from the heatmap when written, so
+		// self-modifying code counts under the first instruction seen
+		if (heat[address]++ == 0) {
+			opcodes[address] = opcode;
+		}
+		if ((opcode & 0xF000) == 0x2000) {
+			call(opcode & 0x0FFF, cycles);
+		}
+		else if (opcode == 0x00EE) {
+			leave(cycles);
+		}
+	}
+
+	// instructions differing only in their operands share a class, the key
+	// is the high nibble then whatever low bits tell the instruction apart
+	static int opcode_class(std::uint16_t opcode) {
+		static constexpr std::uint16_t selector[16] = { 0xFF, 0, 0, 0, 0, 0xF, 0, 0, 0xF, 0xF, 0, 0, 0, 0, 0xFF, 0xFF };
+		return (opcode >> 12) << 8 | (opcode & selector[opcode >> 12]);
+	}
+	static std::string class_name(int opcode_class);
+
+	bool write_json(const std::string& path) const;
+	bool write_folded(const std::string& path) const;
+};
+#endif
@@ -0,0 +1,143 @@
+#include "romdb.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr std::uint32_t DB_MAGIC = 0x42445841;  // "AXDB"
+constexpr std::uint32_t DB_VERSION = 1;
+constexpr std::uint64_t RECORD_SIZE = 35;
+
+const std::array<const char*, 5> profile_names = { { "legacy", "vip", "chip48", "schip", "xochip" } };
+
+template <typename T>
+void write_value(std::ofstream& file, T value) {
+	file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool read_value(std::ifstream& file, T& value) {
+	return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+std::uint64_t bytes_left(std::ifstream& file) {
+	std::ifstream::pos_type here = file.tellg();
+	file.seekg(0, std::ios::end);
+	std::ifstream::pos_type end = file.tellg();
+	file.seekg(here);
+	return static_cast<std::uint64_t>(end - here);
+}
+}
+
+bool RomDatabase::load(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	std::uint32_t magic, version, count;
+	if (!read_value(file, magic) || !read_value(file, version) || !read_value(file, count) ||
+		magic != DB_MAGIC || version != DB_VERSION) {
+		return false;
+	}
+
+	// 35 bytes per record: hash, instructions per frame, quirk profile,
+	// background and foreground colour, then the 16 entry keymap; a count
+	// the file is too short for is rejected before anything is allocated
+	if (count > bytes_left(file) / RECORD_SIZE) {
+		return false;
+	}
+	std::vector<Record> loaded(count);
+	for (Record& record : loaded) {
+		std::uint8_t quirks;
+		if (!read_value(file, record.hash) || !read_value(file, record.settings.instructions_per_frame) ||
+			!read_value(file, quirks) || !read_value(file, record.settings.background) ||
+			!read_value(file, record.settings.foreground) || !read_value(file, record.settings.keymap)) {
+			return false;
+		}
+		// a profile that does not exist would pick no interpreter at all
+		if (quirks >= profile_names.size()) {
+			return false;
+		}
+		record.settings.quirks = static_cast<QuirkProfile>(quirks);
+	}
+	std::sort(loaded.begin(), loaded.end(), [](const Record& a, const Record& b) {
+		return a.hash < b.hash;
+	});
+	records.swap(loaded);
+	return true;
+}
+
+bool RomDatabase::save(const std::string& path) const {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	write_value(file, DB_MAGIC);
+	write_value(file, DB_VERSION);
+	write_value(file, static_cast<std::uint32_t>(records.size()));
+	for (const Record& record : records) {
+		write_value(file, record.hash);
+		write_value(file, record.settings.instructions_per_frame);
+		write_value(file, static_cast<std::uint8_t>(record.settings.quirks));
+		write_value(file, record.settings.background);
+		write_value(file, record.settings.foreground);
+		write_value(file, record.settings.keymap);
+	}
+	return static_cast<bool>(file);
+}
+
+const RomSettings* RomDatabase::find(std::uint64_t hash) const {
+	auto found = std::lower_bound(records.begin(), records.end(), hash, [](const Record& record, std::uint64_t key) {
+		return record.hash < key;
+	});
+	if (found == records.end() || found->hash != hash) {
+		return nullptr;
+	}
+	return &found->settings;
+}
+
+void RomDatabase::set(std::uint64_t hash, const RomSettings& settings) {
+	auto found = std::lower_bound(records.begin(), records.end(), hash, [](const Record& record, std::uint64_t key) {
+		return record.hash < key;
+	});
+	if (found != records.end() && found->hash == hash) {
+		found->settings = settings;
+	}
+	else {
+		records.insert(found, Record{ hash, settings });
+	}
+}
+
+bool RomDatabase::remove(std::uint64_t hash) {
+	auto found = std::lower_bound(records.begin(), records.end(), hash, [](const Record& record, std::uint64_t key) {
+		return record.hash < key;
+	});
+	if (found == records.end() || found->hash != hash) {
+		return false;
+	}
+	records.erase(found);
+	return true;
+}
+
+int RomDatabase::size() const {
+	return records.size();
+}
+
+std::uint64_t RomDatabase::hash(int index) const {
+	return records[index].hash;
+}
+
+const RomSettings& RomDatabase::settings(int index) const {
+	return records[index].settings;
+}
+
+const char* quirk_profile_name(QuirkProfile quirks) {
+	return profile_names[static_cast<int>(quirks)];
+}
+
+bool parse_quirk_profile(const std::string& name, QuirkProfile& quirks) {
+	for (std::size_t i = 0; i < profile_names.size(); i++) {
+		if (name == profile_names[i]) {
+			quirks = static_cast<QuirkProfile>(i);
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,35 @@
+#ifndef ROMDB
+#define ROMDB
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+// a database of settings keyed by rom content hash, stored as a sorted array
+// of fixed size records so a lookup is one binary search
+class RomDatabase {
+private:
+	struct Record {
+		std::uint64_t hash;
+		RomSettings settings;
+	};
+
+	std::vector<Record> records;  // sorted by hash
+
+public:
+	bool load(const std::string& path);
+	bool save(const std::string& path) const;
+	const RomSettings* find(std::uint64_t hash) const;
+	void set(std::uint64_t hash, const RomSettings& settings);
+	bool remove(std::uint64_t hash);
+	int size() const;
+	std::uint64_t hash(int index) const;
+	const RomSettings& settings(int index) const;
+};
+
+// short names used for quirk profiles in tools and settings files
+const char* quirk_profile_name(QuirkProfile quirks);
+bool parse_quirk_profile(const std::string& name, QuirkProfile& quirks);
+#endif
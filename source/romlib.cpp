@@ -0,0 +1,193 @@
+#include "romlib.h"
+#include "hash.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#ifdef _WIN32
+#include "dirent.h"
+#ifndef S_ISREG
+#define S_ISREG(mode) (((mode) & S_IFMT) == S_IFREG)
+#endif
+#else
+#include <dirent.h>
+#endif
+
+namespace {
+constexpr std::uint32_t CACHE_MAGIC = 0x4C525841;  // "AXRL"
+constexpr std::uint32_t CACHE_VERSION = 1;
+constexpr std::uint64_t ENTRY_MIN_SIZE = 22;  // size, mtime, hash and name length
+constexpr std::int64_t MAX_ROM_SIZE = 65536 - 512;
+
+int compare_names(const std::string& a, const std::string& b) {
+	std::size_t length = std::min(a.size(), b.size());
+	for (std::size_t i = 0; i < length; i++) {
+		int ca = std::tolower(static_cast<unsigned char>(a[i]));
+		int cb = std::tolower(static_cast<unsigned char>(b[i]));
+		if (ca != cb) {
+			return ca < cb ? -1 : 1;
+		}
+	}
+	return a.size() < b.size() ? -1 : a.size() > b.size();
+}
+
+bool name_less(const RomEntry& entry, const std::string& name) {
+	return compare_names(entry.name, name) < 0;
+}
+
+template <typename T>
+void write_value(std::ofstream& file, T value) {
+	file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool read_value(std::ifstream& file, T& value) {
+	return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+std::uint64_t bytes_left(std::ifstream& file) {
+	std::ifstream::pos_type here = file.tellg();
+	file.seekg(0, std::ios::end);
+	std::ifstream::pos_type end = file.tellg();
+	file.seekg(here);
+	return static_cast<std::uint64_t>(end - here);
+}
+}
+
+RomLibrary::RomLibrary() {
+	directory_mtime = 0;
+}
+
+void RomLibrary::open(const std::string& dir, const std::string& cache_path) {
+	directory = dir;
+	entries.clear();
+
+	struct stat st;
+	std::int64_t mtime = stat(dir.c_str(), &st) == 0 ? st.st_mtime : 0;
+
+	// an unchanged directory needs neither readdir nor a stat per file, some
+	// filesystems report no directory mtime so 0 always forces a rescan
+	if (load_cache(cache_path) && mtime != 0 && mtime == directory_mtime) {
+		return;
+	}
+	directory_mtime = mtime;
+	scan();
+	save_cache(cache_path);
+}
+
+void RomLibrary::scan() {
+	DIR* dir = opendir(directory.c_str());
+	if (dir == nullptr) {
+		entries.clear();
+		return;
+	}
+
+	// entries from the cache are reused when size and mtime still match so
+	// only new or modified roms are read and hashed
+	std::vector<RomEntry> cached;
+	cached.swap(entries);
+
+	struct dirent* ent;
+	while ((ent = readdir(dir)) != nullptr) {
+		std::string name = ent->d_name;
+		if (name.empty() || name[0] == '.') {  // skips ".", ".." and hidden files
+			continue;
+		}
+		struct stat st;
+		std::string file_path = directory + "/" + name;
+		if (stat(file_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		// anything larger is not a rom load_rom would take, and is never
+		// read into memory to be hashed
+		if (st.st_size > MAX_ROM_SIZE) {
+			continue;
+		}
+
+		RomEntry entry;
+		entry.name = name;
+		entry.size = st.st_size;
+		entry.mtime = st.st_mtime;
+
+		auto old = std::lower_bound(cached.begin(), cached.end(), name, name_less);
+		if (old != cached.end() && old->name == name && old->size == entry.size && old->mtime == entry.mtime) {
+			entry.hash = old->hash;
+		}
+		else {
+			std::ifstream file(file_path, std::ios::binary);
+			std::vector<char> buffer(entry.size);
+			file.read(buffer.data(), entry.size);
+			entry.hash = hash_bytes(buffer.data(), file.gcount());
+		}
+		entries.push_back(entry);
+	}
+	closedir(dir);
+
+	std::sort(entries.begin(), entries.end(), [](const RomEntry& a, const RomEntry& b) {
+		return compare_names(a.name, b.name) < 0;
+	});
+}
+
+bool RomLibrary::load_cache(const std::string& cache_path) {
+	std::ifstream file(cache_path, std::ios::binary);
+	std::uint32_t magic, version, count;
+	if (!read_value(file, magic) || !read_value(file, version) || magic != CACHE_MAGIC || version != CACHE_VERSION) {
+		return false;
+	}
+	if (!read_value(file, directory_mtime) || !read_value(file, count)) {
+		return false;
+	}
+
+	// every entry takes at least its fixed fields, so a count the file is too
+	// short for is rejected before anything is allocated
+	if (count > bytes_left(file) / ENTRY_MIN_SIZE) {
+		return false;
+	}
+	std::vector<RomEntry> loaded(count);
+	for (RomEntry& entry : loaded) {
+		std::uint16_t name_length;
+		if (!read_value(file, entry.size) || !read_value(file, entry.mtime) || !read_value(file, entry.hash) || !read_value(file, name_length)) {
+			return false;
+		}
+		entry.name.resize(name_length);
+		if (!file.read(&entry.name[0], name_length)) {
+			return false;
+		}
+	}
+	entries.swap(loaded);
+	return true;
+}
+
+void RomLibrary::save_cache(const std::string& cache_path) {
+	std::ofstream file(cache_path, std::ios::binary | std::ios::trunc);
+	write_value(file, CACHE_MAGIC);
+	write_value(file, CACHE_VERSION);
+	write_value(file, directory_mtime);
+	write_value(file, static_cast<std::uint32_t>(entries.size()));
+	for (const RomEntry& entry : entries) {
+		write_value(file, entry.size);
+		write_value(file, entry.mtime);
+		write_value(file, entry.hash);
+		write_value(file, static_cast<std::uint16_t>(entry.name.size()));
+		file.write(entry.name.data(), entry.name.size());
+	}
+}
+
+int RomLibrary::size() const {
+	return entries.size();
+}
+
+const RomEntry& RomLibrary::get(int index) const {
+	return entries[index];
+}
+
+std::string RomLibrary::path(int index) const {
+	return directory + "/" + entries[index].name;
+}
+
+int RomLibrary::lower_bound(const std::string& prefix) const {
+	return std::lower_bound(entries.begin(), entries.end(), prefix, name_less) - entries.begin();
+}
@@ -0,0 +1,35 @@
+#ifndef ROMLIB
+#define ROMLIB
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct RomEntry {
+	std::string name;     // file name inside the library directory
+	std::uint32_t size;   // file size in bytes
+	std::int64_t mtime;   // modification time the hash was taken at
+	std::uint64_t hash;   // hash of the file contents
+};
+
+// index of a rom directory, sorted case-insensitively by name so scrolling
+// is a vector lookup and prefix search is a binary search
+class RomLibrary {
+private:
+	std::string directory;
+	std::int64_t directory_mtime;
+	std::vector<RomEntry> entries;
+
+	bool load_cache(const std::string& cache_path);
+	void save_cache(const std::string& cache_path);
+	void scan();
+
+public:
+	RomLibrary();
+	void open(const std::string& dir, const std::string& cache_path);
+	int size() const;
+	const RomEntry& get(int index) const;
+	std::string path(int index) const;
+	int lower_bound(const std::string& prefix) const;
+};
+#endif
@@ -0,0 +1,253 @@
+#include "rompack.h"
+#include "chip8.h"
+#include "hash.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#if !defined(__SWITCH__) && !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ROMPACK_MMAP
+#endif
+
+namespace {
+constexpr std::uint32_t PACK_MAGIC = 0x4B505841;  // "AXPK"
+constexpr std::uint32_t PACK_VERSION = 1;
+constexpr std::uint32_t EMPTY_SLOT = 0xFFFFFFFF;
+
+std::uint64_t name_hash(const std::string& name) {
+	return hash_bytes(name.data(), name.size());
+}
+
+std::string base_name(const std::string& path) {
+	std::size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+}
+
+RomPack::RomPack() {
+	base = nullptr;
+	length = 0;
+	header = nullptr;
+	table = nullptr;
+	entries = nullptr;
+	mapping = nullptr;
+}
+
+RomPack::~RomPack() {
+	close();
+}
+
+bool RomPack::open(const std::string& path) {
+	close();
+#ifdef ROMPACK_MMAP
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED) {
+			mapping = mapped;
+			base = static_cast<const std::uint8_t*>(mapped);
+			length = st.st_size;
+		}
+	}
+	::close(fd);
+#else
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	std::ifstream::pos_type file_size = file.tellg();
+	if (file && file_size > 0) {
+		buffer.resize(file_size);
+		file.seekg(0, std::ios::beg);
+		if (file.read(reinterpret_cast<char*>(buffer.data()), file_size)) {
+			base = buffer.data();
+			length = buffer.size();
+		}
+	}
+#endif
+	if (base == nullptr || !validate()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+// every offset is checked once here so lookups and loads can trust the file
+bool RomPack::validate() {
+	if (length < sizeof(Header)) {
+		return false;
+	}
+	header = reinterpret_cast<const Header*>(base);
+	if (header->magic != PACK_MAGIC || header->version != PACK_VERSION) {
+		return false;
+	}
+	std::uint64_t table_bytes = std::uint64_t(header->table_size) * sizeof(std::uint32_t);
+	std::uint64_t entry_bytes = std::uint64_t(header->count) * sizeof(Entry);
+	if (header->table_size == 0 || (header->table_size & (header->table_size - 1)) != 0 ||
+		header->count >= header->table_size || sizeof(Header) + table_bytes + entry_bytes > length) {
+		return false;
+	}
+	table = reinterpret_cast<const std::uint32_t*>(base + sizeof(Header));
+	entries = reinterpret_cast<const Entry*>(base + sizeof(Header) + table_bytes);
+
+	// every entry in exactly one slot; with count below table_size that
+	// leaves an empty slot, which is what ends a probe for a missing name
+	std::vector<bool> placed(header->count);
+	std::uint32_t occupied = 0;
+	for (std::uint32_t i = 0; i < header->table_size; i++) {
+		if (table[i] == EMPTY_SLOT) {
+			continue;
+		}
+		if (table[i] >= header->count || placed[table[i]]) {
+			return false;
+		}
+		placed[table[i]] = true;
+		occupied++;
+	}
+	if (occupied != header->count) {
+		return false;
+	}
+	for (std::uint32_t i = 0; i < header->count; i++) {
+		const Entry& entry = entries[i];
+		if (std::uint64_t(entry.name_offset) + entry.name_length > length ||
+			std::uint64_t(entry.data_offset) + entry.size > length) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void RomPack::close() {
+#ifdef ROMPACK_MMAP
+	if (mapping != nullptr) {
+		munmap(mapping, length);
+	}
+#endif
+	buffer.clear();
+	mapping = nullptr;
+	base = nullptr;
+	length = 0;
+	header = nullptr;
+	table = nullptr;
+	entries = nullptr;
+}
+
+int RomPack::size() const {
+	return header == nullptr ? 0 : header->count;
+}
+
+std::string RomPack::name(int index) const {
+	const Entry& entry = entries[index];
+	return std::string(reinterpret_cast<const char*>(base + entry.name_offset), entry.name_length);
+}
+
+std::uint64_t RomPack::hash(int index) const {
+	return entries[index].content_hash;
+}
+
+const std::uint8_t* RomPack::data(int index) const {
+	return base + entries[index].data_offset;
+}
+
+std::size_t RomPack::rom_size(int index) const {
+	return entries[index].size;
+}
+
+int RomPack::find(const std::string& rom_name) const {
+	if (header == nullptr) {
+		return -1;
+	}
+	std::uint64_t key = name_hash(rom_name);
+	std::uint32_t mask = header->table_size - 1;
+	for (std::uint32_t slot = key & mask;; slot = (slot + 1) & mask) {
+		std::uint32_t index = table[slot];
+		if (index == EMPTY_SLOT) {
+			return -1;
+		}
+		const Entry& entry = entries[index];
+		if (entry.name_hash == key && entry.name_length == rom_name.size() &&
+			std::memcmp(base + entry.name_offset, rom_name.data(), rom_name.size()) == 0) {
+			return index;
+		}
+	}
+}
+
+bool RomPack::load(int index, Chip8& chip8) const {
+	return chip8.load_rom(data(index), rom_size(index));
+}
+
+bool RomPack::build(const std::string& path, const std::vector<std::string>& rom_paths) {
+	std::vector<std::string> names;
+	std::vector<std::vector<std::uint8_t>> payloads;
+	for (const std::string& rom_path : rom_paths) {
+		std::ifstream file(rom_path, std::ios::binary | std::ios::ate);
+		std::ifstream::pos_type file_size = file.tellg();
+		if (!file) {
+			return false;
+		}
+		std::vector<std::uint8_t> payload(file_size);
+		file.seekg(0, std::ios::beg);
+		file.read(reinterpret_cast<char*>(payload.data()), file_size);
+		names.push_back(base_name(rom_path));
+		payloads.push_back(std::move(payload));
+	}
+	// roms are found by base name, a second one with the same name could
+	// never be looked up
+	std::unordered_set<std::string> unique(names.begin(), names.end());
+	if (unique.size() != names.size()) {
+		return false;
+	}
+
+	// keep the table at most half full so probes stay short
+	Header out_header;
+	out_header.magic = PACK_MAGIC;
+	out_header.version = PACK_VERSION;
+	out_header.count = names.size();
+	out_header.table_size = 2;
+	while (out_header.table_size < out_header.count * 2) {
+		out_header.table_size *= 2;
+	}
+
+	std::vector<std::uint32_t> out_table(out_header.table_size, EMPTY_SLOT);
+	std::vector<Entry> out_entries(out_header.count);
+	std::uint32_t offset = sizeof(Header) + out_table.size() * sizeof(std::uint32_t) + out_entries.size() * sizeof(Entry);
+	for (std::uint32_t i = 0; i < out_header.count; i++) {
+		out_entries[i].name_hash = name_hash(names[i]);
+		out_entries[i].name_offset = offset;
+		out_entries[i].name_length = names[i].size();
+		offset += names[i].size();
+	}
+	for (std::uint32_t i = 0; i < out_header.count; i++) {
+		out_entries[i].content_hash = hash_bytes(payloads[i].data(), payloads[i].size());
+		out_entries[i].data_offset = offset;
+		out_entries[i].size = payloads[i].size();
+		offset += payloads[i].size();
+
+		std::uint32_t mask = out_header.table_size - 1;
+		std::uint32_t slot = out_entries[i].name_hash & mask;
+		while (out_table[slot] != EMPTY_SLOT) {
+			slot = (slot + 1) & mask;
+		}
+		out_table[slot] = i;
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(&out_header), sizeof(out_header));
+	file.write(reinterpret_cast<const char*>(out_table.data()), out_table.size() * sizeof(std::uint32_t));
+	file.write(reinterpret_cast<const char*>(out_entries.data()), out_entries.size() * sizeof(Entry));
+	for (const std::string& name : names) {
+		file.write(name.data(), name.size());
+	}
+	for (const std::vector<std::uint8_t>& payload : payloads) {
+		file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+	}
+	return static_cast<bool>(file);
+}
@@ -0,0 +1,58 @@
+#ifndef ROMPACK
+#define ROMPACK
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Chip8;
+
+// read-only archive of many roms: a header, an open addressing hash table
+// over the rom names, an entry array, a name blob and the payloads stored
+// back to back; it is mapped once and roms are loaded straight from it
+class RomPack {
+private:
+	struct Header {
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::uint32_t count;        // number of entries
+		std::uint32_t table_size;   // slots in the name table, a power of two
+	};
+
+	struct Entry {
+		std::uint64_t name_hash;
+		std::uint64_t content_hash;
+		std::uint32_t name_offset;  // from the start of the file
+		std::uint32_t name_length;
+		std::uint32_t data_offset;  // from the start of the file
+		std::uint32_t size;
+	};
+
+	const std::uint8_t* base;
+	std::size_t length;
+	const Header* header;
+	const std::uint32_t* table;     // entry index per slot, EMPTY_SLOT if unused
+	const Entry* entries;
+	void* mapping;
+	std::vector<std::uint8_t> buffer;  // holds the file where mmap is unavailable
+
+	bool validate();
+
+public:
+	RomPack();
+	~RomPack();
+	RomPack(const RomPack&) = delete;
+	RomPack& operator=(const RomPack&) = delete;
+	bool open(const std::string& path);
+	void close();
+	int size() const;
+	std::string name(int index) const;
+	std::uint64_t hash(int index) const;
+	const std::uint8_t* data(int index) const;
+	std::size_t rom_size(int index) const;
+	int find(const std::string& name) const;
+	bool load(int index, Chip8& chip8) const;
+	static bool build(const std::string& path, const std::vector<std::string>& rom_paths);
+};
+#endif
@@ -0,0 +1,177 @@
+#include "scheduler.h"
+#include <mutex>
+
+Scheduler::Scheduler(int threads) : next(0), ticks(0), generation(0), busy(0), stopping(false) {
+	kept.resize(threads > 0 ? threads : 1);
+	sleeping.resize(kept.size());
+	for (int i = 0; i < threads; i++) {
+		workers.emplace_back(&Scheduler::work, this, i);
+	}
+}
+
+Scheduler::~Scheduler() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+int Scheduler::add(Chip8* machine, int instructions) {
+	sessions.emplace_back(new Session());
+	Session& session = *sessions.back();
+	session.machine = machine;
+	session.instructions = instructions;
+	session.posted = false;
+	session.parked = false;
+	session.waiting = false;
+	session.alarm = 0;
+	session.ran = ticks;
+	session.frames = 0;
+	runnable.push_back(&session);
+	return static_cast<int>(sessions.size() - 1);
+}
+
+void Scheduler::post_key(int id, int key, bool pressed) {
+	Session& session = *sessions[id];
+	bool was_parked;
+	{
+		// cycle 0 has always passed, so the event applies before the first
+		// instruction of the frame
+		std::lock_guard<std::mutex> guard(session.lock);
+		session.inbox.push_back(KeyEvent{ 0, static_cast<std::uint8_t>(key & 0xF), pressed });
+		session.posted = true;
+		was_parked = session.parked;
+		session.parked = false;
+	}
+	if (was_parked) {
+		std::lock_guard<std::mutex> guard(lock);
+		woken.push_back(&session);
+	}
+}
+
+void Scheduler::tick() {
+	ticks++;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		runnable.insert(runnable.end(), woken.begin(), woken.end());
+		woken.clear();
+	}
+	// timer waits that run out now; one a key already woke, or that has
+	// parked again since, left its alarm behind and is not woken twice
+	for (; !alarms.empty() && alarms.top().first <= ticks; alarms.pop()) {
+		Session& session = *alarms.top().second;
+		std::lock_guard<std::mutex> guard(session.lock);
+		if (session.parked && session.waiting && session.alarm == alarms.top().first) {
+			session.parked = false;
+			runnable.push_back(&session);
+		}
+	}
+	next = 0;
+	if (workers.empty()) {
+		run(0);
+	}
+	else {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			generation++;
+			busy = static_cast<int>(workers.size());
+		}
+		wake.notify_all();
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [this] { return busy == 0; });
+	}
+	runnable.clear();
+	for (std::vector<Session*>& part : kept) {
+		runnable.insert(runnable.end(), part.begin(), part.end());
+		part.clear();
+	}
+	for (std::vector<Alarm>& part : sleeping) {
+		for (const Alarm& alarm : part) {
+			alarms.push(alarm);
+		}
+		part.clear();
+	}
+}
+
+void Scheduler::work(int worker) {
+	std::uint64_t seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [&] { return stopping || generation != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+		}
+		run(worker);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			busy--;
+		}
+		done.notify_one();
+	}
+}
+
+void Scheduler::run(int worker) {
+	std::vector<Session*>& keep = kept[worker];
+	for (std::size_t i = next++; i < runnable.size(); i = next++) {
+		Session& session = *runnable[i];
+		if (session.waiting) {
+			// the frames it was parked for only spun in the wait and ran the
+			// timers down, running them now changes nothing they would have
+			for (std::uint64_t missed = session.ran + 1; missed < ticks; missed++) {
+				session.machine->run_frame(session.instructions);
+				session.frames++;
+			}
+			session.waiting = false;
+		}
+		if (session.posted) {
+			std::lock_guard<std::mutex> guard(session.lock);
+			session.events.swap(session.inbox);
+			session.posted = false;
+		}
+		session.machine->run_frame(session.instructions, session.events.data(), static_cast<int>(session.events.size()));
+		session.events.clear();
+		session.frames++;
+		session.ran = ticks;
+
+		// parked under the session's lock, so a key posted meanwhile either
+		// is seen here or sees the session parked and wakes it
+		if (session.machine->is_stalled()) {
+			std::lock_guard<std::mutex> guard(session.lock);
+			if (!session.posted) {
+				session.parked = true;
+				continue;
+			}
+		}
+		else if (int wait = session.machine->get_timer_wait()) {
+			std::lock_guard<std::mutex> guard(session.lock);
+			if (!session.posted) {
+				session.parked = true;
+				session.waiting = true;
+				session.alarm = ticks + wait + 1;
+				sleeping[worker].push_back(Alarm(session.alarm, &session));
+				continue;
+			}
+		}
+		keep.push_back(&session);
+	}
+}
+
+std::size_t Scheduler::get_runnable() {
+	std::lock_guard<std::mutex> guard(lock);
+	return runnable.size() + woken.size();
+}
+
+std::size_t Scheduler::get_parked() {
+	return sessions.size() - get_runnable();
+}
+
+std::uint64_t Scheduler::get_frames(int session) {
+	return sessions[session]->frames;
+}
@@ -0,0 +1,78 @@
+#ifndef SCHEDULER
+#define SCHEDULER
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "chip8.h"
+
+// runs many machines on a few worker threads, one frame each per tick. A
+// frame is where a machine gives its thread up; a machine that ends one
+// stalled (Chip8::is_stalled) is parked instead of queued again, and costs
+// nothing until a key is posted to it. One that ends a frame in a timer
+// wait (Chip8::get_timer_wait) is parked until the wait runs out or a key
+// is posted, then runs the frames it missed back to back before its own,
+// so it ends up exactly where running every tick would have left it. This
+// is what a coroutine per machine would give, without one: a frame is
+// already a point at which a machine can be suspended and picked up again
+// by any thread
+class Scheduler {
+private:
+	struct Session {
+		Chip8* machine;
+		int instructions;
+		std::mutex lock;               // guards inbox and parked
+		std::vector<KeyEvent> inbox;   // posted since its last frame
+		std::atomic<bool> posted;      // inbox is not empty, read without the lock
+		std::vector<KeyEvent> events;  // the inbox taken for the running frame
+		bool parked;
+		bool waiting;                  // parked in a timer wait, owes the frames since ran
+		std::uint64_t alarm;           // tick the timer wait runs out at
+		std::uint64_t ran;             // tick of its last frame
+		std::uint64_t frames;
+	};
+	typedef std::pair<std::uint64_t, Session*> Alarm;
+
+	std::vector<std::unique_ptr<Session>> sessions;
+	std::vector<Session*> runnable;
+	std::vector<std::vector<Session*>> kept;  // per worker, runnable again next tick
+	std::vector<std::vector<Alarm>> sleeping; // per worker, timer waits parked this tick
+	std::priority_queue<Alarm, std::vector<Alarm>, std::greater<Alarm>> alarms;
+	std::atomic<std::size_t> next;
+	std::uint64_t ticks;
+
+	std::mutex lock;
+	std::condition_variable wake;             // a tick has started
+	std::condition_variable done;             // a worker has finished its part
+	std::vector<Session*> woken;              // parked sessions a key was posted to
+	std::uint64_t generation;
+	int busy;
+	bool stopping;
+	std::vector<std::thread> workers;
+
+	void work(int worker);
+	void run(int worker);
+
+public:
+	explicit Scheduler(int threads);  // 0 runs ticks on the calling thread
+	~Scheduler();
+	// not while a tick runs or keys are being posted; the machine is borrowed
+	int add(Chip8* machine, int instructions);
+	// from any thread at any time, the key lands at the start of the session's
+	// next frame
+	void post_key(int session, int key, bool pressed);
+	void tick();
+	// between ticks
+	std::size_t get_runnable();
+	std::size_t get_parked();
+	std::uint64_t get_frames(int session);
+};
+#endif
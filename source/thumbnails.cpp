@@ -0,0 +1,114 @@
+#include "thumbnails.h"
+#include "chip8.h"
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+ThumbnailCache::ThumbnailCache(const std::string& dir, int frames, const RomDatabase* database, int threads)
+	: cache_dir(dir), frames(frames), database(database), stopping(false) {
+	for (int i = 0; i < threads; i++) {
+		workers.emplace_back(&ThumbnailCache::work, this);
+	}
+}
+
+ThumbnailCache::~ThumbnailCache() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+bool ThumbnailCache::get(std::uint64_t hash, const std::string& rom_path, Thumbnail& thumbnail) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto found = ready.find(hash);
+	if (found != ready.end()) {
+		thumbnail = found->second;
+		return true;
+	}
+	// the rom the user is looking at now matters more than older requests
+	if (pending.insert(hash).second) {
+		jobs.push_front(Job{ hash, rom_path });
+		wake.notify_one();
+	}
+	return false;
+}
+
+void ThumbnailCache::cancel_pending() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (const Job& job : jobs) {
+		pending.erase(job.hash);
+	}
+	jobs.clear();
+}
+
+void ThumbnailCache::work() {
+	for (;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+			if (stopping) {
+				return;
+			}
+			job = jobs.front();
+			jobs.pop_front();
+		}
+
+		Thumbnail thumbnail;
+		if (!load(job.hash, thumbnail)) {
+			generate(job.path, thumbnail);
+			store(job.hash, thumbnail);
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		ready[job.hash] = thumbnail;
+		pending.erase(job.hash);
+	}
+}
+
+void ThumbnailCache::generate(const std::string& rom_path, Thumbnail& thumbnail) {
+	// run at the rom's own speed so the preview matches what the user sees;
+	// the machine holds 64 KB of memory, too much for a worker's stack
+	std::unique_ptr<Chip8> machine(new Chip8());
+	Chip8& chip8 = *machine;
+	chip8.set_database(database);
+	chip8.load_rom(rom_path);
+	for (int i = 0; i < frames; i++) {
+		chip8.run_frame(chip8.get_settings().instructions_per_frame);
+	}
+
+	// a 128x64 screen is sampled every other pixel to fit
+	int step = chip8.get_width() / 64;
+	thumbnail.pixels.fill(0);
+	for (int i = 0; i < 64 * 32; i++) {
+		int x = i % 64 * step;
+		int y = i / 64 * step;
+		if (chip8.get_pixel_data(y * chip8.get_width() + x)) {
+			thumbnail.pixels[i / 8] |= 0x80 >> (i % 8);
+		}
+	}
+}
+
+std::string ThumbnailCache::file_path(std::uint64_t hash) {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016" PRIx64 ".thumb", hash);
+	return cache_dir + name;
+}
+
+bool ThumbnailCache::load(std::uint64_t hash, Thumbnail& thumbnail) {
+	std::ifstream file(file_path(hash), std::ios::binary);
+	return static_cast<bool>(file.read(reinterpret_cast<char*>(thumbnail.pixels.data()), thumbnail.pixels.size()));
+}
+
+void ThumbnailCache::store(std::uint64_t hash, const Thumbnail& thumbnail) {
+	std::ofstream file(file_path(hash), std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(thumbnail.pixels.data()), thumbnail.pixels.size());
+}
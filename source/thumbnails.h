@@ -0,0 +1,55 @@
+#ifndef THUMBNAILS
+#define THUMBNAILS
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class RomDatabase;
+
+// still preview of a rom, one bit per pixel with the msb as the leftmost pixel
+struct Thumbnail {
+	std::array<std::uint8_t, 64 * 32 / 8> pixels;
+};
+
+// generates previews on worker threads by running each rom headlessly in its
+// own Chip8, and caches them on disk keyed by rom hash; the ui thread only
+// ever touches the in-memory map so it never waits on emulation or disk
+class ThumbnailCache {
+private:
+	struct Job {
+		std::uint64_t hash;
+		std::string path;
+	};
+
+	std::string cache_dir;
+	int frames;
+	const RomDatabase* database;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<Job> jobs;                                  // newest request first
+	std::unordered_set<std::uint64_t> pending;             // queued or in progress
+	std::unordered_map<std::uint64_t, Thumbnail> ready;
+	std::vector<std::thread> workers;
+	bool stopping;
+
+	void work();
+	std::string file_path(std::uint64_t hash);
+	bool load(std::uint64_t hash, Thumbnail& thumbnail);
+	void store(std::uint64_t hash, const Thumbnail& thumbnail);
+	void generate(const std::string& rom_path, Thumbnail& thumbnail);
+
+public:
+	ThumbnailCache(const std::string& dir, int frames, const RomDatabase* database, int threads);
+	~ThumbnailCache();
+	bool get(std::uint64_t hash, const std::string& rom_path, Thumbnail& thumbnail);
+	void cancel_pending();
+};
+#endif
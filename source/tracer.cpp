@@ -0,0 +1,90 @@
+#include "tracer.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+// unbuffered file calls, nothing here allocates
+int create_file(const char* path) {
+#ifdef _WIN32
+	return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+}
+
+bool write_all(int file, const void* data, std::size_t size) {
+	const char* bytes = static_cast<const char*>(data);
+	while (size > 0) {
+#ifdef _WIN32
+		int written = _write(file, bytes, static_cast<unsigned>(size < 0x40000000 ? size : 0x40000000));
+#else
+		long written = write(file, bytes, size);
+#endif
+		if (written <= 0) {
+			return false;
+		}
+		bytes += written;
+		size -= static_cast<std::size_t>(written);
+	}
+	return true;
+}
+
+int close_file(int file) {
+#ifdef _WIN32
+	return _close(file);
+#else
+	return close(file);
+#endif
+}
+}
+
+Tracer::Tracer(int capacity_log2) : ring(std::size_t(1) << capacity_log2), mask((std::uint64_t(1) << capacity_log2) - 1) {
+	reset();
+}
+
+void Tracer::reset() {
+	executed.store(0, std::memory_order_release);
+	address = 0;
+}
+
+std::uint64_t Tracer::get_executed() const {
+	return executed.load(std::memory_order_acquire);
+}
+
+bool Tracer::dump(const std::string& path, std::uint64_t rom_hash) const {
+	return dump(path.c_str(), rom_hash);
+}
+
+bool Tracer::dump(const char* path, std::uint64_t rom_hash) const {
+	// open and write on the ring as it stands, no stdio buffer or other
+	// allocation, so this still works from a crash handler
+	int file = create_file(path);
+	if (file < 0) {
+		return false;
+	}
+	std::uint64_t total = executed.load(std::memory_order_acquire);
+	std::uint64_t count = total < ring.size() ? total : ring.size();
+	TraceHeader header;
+	std::memcpy(header.magic, "C8TR", 4);
+	header.version = TRACE_VERSION;
+	header.executed = total;
+	header.rom_hash = rom_hash;
+	header.count = static_cast<std::uint32_t>(count);
+	header.reserved = 0;
+	bool written = write_all(file, &header, sizeof(header));
+
+	// oldest first, the ring wraps at most once between the two halves
+	std::uint64_t first = (total - count) & mask;
+	std::uint64_t head = count < ring.size() - first ? count : ring.size() - first;
+	written = written && write_all(file, &ring[first], head * sizeof(TraceEntry));
+	written = written && write_all(file, ring.data(), (count - head) * sizeof(TraceEntry));
+	return close_file(file) == 0 && written;
+}
@@ -0,0 +1,99 @@
+#ifndef TRACER
+#define TRACER
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "observer.h"
+
+// one executed instruction: where it ran, what it was, and I, Vx and VF
+// after it; between them they hold whatever register it changed, which one
+// is worked out from the opcode when decoding
+struct TraceEntry {
+	std::uint16_t pc;
+	std::uint16_t opcode;
+	std::uint16_t I;
+	std::uint8_t vx;
+	std::uint8_t vf;
+};
+static_assert(sizeof(TraceEntry) == 8, "trace entries are written to disk as is");
+
+// start of a trace file, followed by count entries from oldest to newest
+struct TraceHeader {
+	char magic[4];           // "C8TR"
+	std::uint32_t version;
+	std::uint64_t executed;  // instructions traced in total, the file keeps the last count
+	std::uint64_t rom_hash;
+	std::uint32_t count;
+	std::uint32_t reserved;
+};
+
+constexpr std::uint8_t NO_REGISTER = 0xFF;
+constexpr std::uint32_t TRACE_VERSION = 1;
+
+// records the last instructions a Chip8 ran into a fixed ring while attached
+// as its observer; recording is a few stores per instruction with no
+// formatting, the ring is written out as binary and decoded offline
+class Tracer : public NullObserver {
+private:
+	std::vector<TraceEntry> ring;           // size is a power of two
+	std::uint64_t mask;
+	std::uint16_t address;                  // of the instruction being executed
+
+	// only the emulation thread writes; the count is published with a
+	// release store so a dump taken elsewhere sees entries up to it whole
+	std::atomic<std::uint64_t> executed;
+
+public:
+	explicit Tracer(int capacity_log2 = 20);  // a million entries, 8 MB
+	void reset();
+
+	void on_fetch(std::uint16_t fetched, std::uint16_t, std::uint64_t) {
+		address = fetched;
+	}
+	bool on_execute(const Chip8State& state) {
+		std::uint64_t n = executed.load(std::memory_order_relaxed);
+		// built whole and stored once, eight byte stores would each make the
+		// compiler reload the ring in case they changed it
+		TraceEntry entry = { address, state.opcode, state.I, state.V[(state.opcode & 0x0F00) >> 8], state.V[0xF] };
+		ring[n & mask] = entry;
+		executed.store(n + 1, std::memory_order_release);
+		return false;
+	}
+
+	// the register an instruction leaves its result in, NO_REGISTER when
+	// none; for those writing several it is the one most worth seeing, Vx
+	// for loads and VF for Dxyn
+	static std::uint8_t written_register(std::uint16_t opcode) {
+		std::uint8_t x = (opcode & 0x0F00) >> 8;
+		switch (opcode & 0xF000) {
+		case 0x5000:
+			return (opcode & 0x000F) == 3 ? x : NO_REGISTER;
+		case 0x6000:
+		case 0x7000:
+		case 0x8000:
+		case 0xC000:
+			return x;
+		case 0xD000:
+			return 0xF;
+		case 0xF000:
+			switch (opcode & 0x00FF) {
+			case 0x07:
+			case 0x0A:
+			case 0x65:
+			case 0x85:
+				return x;
+			}
+			break;
+		}
+		return NO_REGISTER;
+	}
+
+	std::uint64_t get_executed() const;
+	bool dump(const std::string& path, std::uint64_t rom_hash) const;
+	// the same without building a string, for a crash handler
+	bool dump(const char* path, std::uint64_t rom_hash) const;
+};
+#endif
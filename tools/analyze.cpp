@@ -0,0 +1,63 @@
+// Prints what the static analyzer finds in a rom: its basic blocks with a
+// disassembly, the quirk sensitive instructions it uses and its idle loops.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/analyze.cpp source/analyzer.cpp source/romdb.cpp -o analyze
+//
+// Usage:
+//   analyze <rom>
+#include "analyzer.h"
+#include "romdb.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s <rom>\n", argv[0]);
+		return 1;
+	}
+	std::ifstream file(argv[1], std::ios::binary);
+	if (!file) {
+		std::fprintf(stderr, "%s: cannot open rom\n", argv[1]);
+		return 1;
+	}
+	std::vector<std::uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	RomAnalysis analysis = analyze_rom(rom.data(), rom.size());
+
+	for (const BasicBlock& block : analysis.blocks) {
+		std::printf("block %03X-%03X ->", block.start, block.end);
+		for (int i = 0; i < block.successor_count; i++) {
+			std::printf(" %03X", block.successors[i]);
+		}
+		std::printf("\n");
+		for (std::uint16_t at = block.start; at < block.end; at += 2) {
+			std::uint16_t opcode = rom[at - 0x200] << 8 | rom[at - 0x200 + 1];
+			std::printf("  %03X  %04X  %s\n", at, opcode, disassemble(opcode).c_str());
+			if (opcode == 0xF000) {
+				at += 2;  // the long address is data
+			}
+		}
+	}
+
+	std::printf("\ncode bytes: %zu of %zu\n", analysis.code.count(), rom.size());
+	if (analysis.computed_jumps) {
+		std::printf("computed jumps: yes, blocks reached only through Bnnn are missing\n");
+	}
+	std::printf("uses: %s%s%s%s%s%s%s\n", analysis.uses_shift ? "shift " : "", analysis.uses_load_store ? "load-store " : "",
+		analysis.uses_jump_offset ? "jump-offset " : "", analysis.uses_logic ? "logic " : "",
+		analysis.uses_index_add ? "index-add " : "", analysis.uses_superchip ? "superchip " : "",
+		analysis.uses_xochip ? "xochip" : "");
+	for (std::uint16_t address : analysis.timer_loops) {
+		std::printf("timer loop at %03X\n", address);
+	}
+	for (std::uint16_t address : analysis.halt_loops) {
+		std::printf("halt loop at %03X\n", address);
+	}
+	for (const MemoryRange& range : analysis.self_modifying) {
+		std::printf("self-modifying write %03X-%03X\n", range.start, range.end - 1);
+	}
+	std::printf("suggested quirks: %s\n", quirk_profile_name(suggest_quirk_profile(analysis)));
+	return 0;
+}
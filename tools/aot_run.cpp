@@ -0,0 +1,121 @@
+// Runs a rom under the interpreter and under its ahead of time translation
+// from tools/recompile side by side, with the same keys pressed at the same
+// cycles, and checks the two machines are identical after every frame. Then
+// times each on its own.
+//
+// Build on the host with:
+//   recompile game.ch8 game.cpp
+//   g++ -O3 -std=gnu++17 -iquote source tools/aot_run.cpp game.cpp source/compiled.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o aot_run
+//
+// Usage:
+//   aot_run <rom> [frames=3600] [instructions per frame=rom's]
+#include "chip8.h"
+#include "compiled.h"
+#include "debugger.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+// a key pressed or released every few frames, partway through, so input
+// paths run and events land inside translated stretches
+int frame_events(int frame, int instructions, std::uint64_t cycles, KeyEvent& event) {
+	if (frame % 7 != 0) {
+		return 0;
+	}
+	std::uint32_t mix = static_cast<std::uint32_t>(frame) * 2654435761u;
+	event.cycle = cycles + (mix >> 8) % static_cast<std::uint32_t>(instructions);
+	event.key = (mix >> 4) & 0xF;
+	event.pressed = (frame / 7) % 2 == 0;
+	return 1;
+}
+
+double timed_run(const std::vector<std::uint8_t>& rom, const Chip8State& start, QuirkProfile quirks,
+	const CompiledRom* compiled, int frames, int instructions) {
+	std::unique_ptr<Chip8> chip8(new Chip8());
+	chip8->load_rom(rom.data(), rom.size());
+	chip8->set_quirk_profile(quirks);
+	chip8->load_state(start);
+	if (compiled != nullptr) {
+		chip8->set_compiled(compiled);
+	}
+	auto begin = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frames; frame++) {
+		KeyEvent event;
+		int count = frame_events(frame, instructions, chip8->get_cycles(), event);
+		chip8->run_frame(instructions, &event, count);
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s <rom> [frames] [instructions per frame]\n", argv[0]);
+		return 1;
+	}
+	std::ifstream file(argv[1], std::ios::binary);
+	std::vector<std::uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	std::unique_ptr<Chip8> interpreted(new Chip8());
+	if (!file.is_open() || !interpreted->load_rom(rom.data(), rom.size())) {
+		std::fprintf(stderr, "%s: could not load rom\n", argv[1]);
+		return 1;
+	}
+	const CompiledRom* compiled = find_compiled_rom(interpreted->get_rom_hash());
+	if (compiled == nullptr) {
+		std::fprintf(stderr, "%s: no translation linked in, see tools/recompile\n", argv[1]);
+		return 1;
+	}
+	int frames = argc > 2 ? std::atoi(argv[2]) : 3600;
+	int instructions = argc > 3 ? std::atoi(argv[3]) : interpreted->get_settings().instructions_per_frame;
+	if (instructions <= 0) {
+		std::fprintf(stderr, "translated roms run a fixed number of instructions per frame\n");
+		return 1;
+	}
+
+	// both start from one snapshot so they draw the same random numbers
+	interpreted->set_quirk_profile(compiled->quirks);
+	std::unique_ptr<Chip8State> start(new Chip8State());
+	interpreted->save_state(*start);
+	std::unique_ptr<Chip8> translated(new Chip8());
+	translated->load_rom(rom.data(), rom.size());
+	translated->set_quirk_profile(compiled->quirks);
+	translated->load_state(*start);
+	if (!translated->set_compiled(compiled)) {
+		std::fprintf(stderr, "%s: translation does not match the rom\n", argv[1]);
+		return 1;
+	}
+
+	std::unique_ptr<Chip8State> expected(new Chip8State());
+	std::unique_ptr<Chip8State> actual(new Chip8State());
+	for (int frame = 0; frame < frames; frame++) {
+		KeyEvent event;
+		int count = frame_events(frame, instructions, interpreted->get_cycles(), event);
+		interpreted->run_frame(instructions, &event, count);
+		translated->run_frame(instructions, &event, count);
+		interpreted->save_state(*expected);
+		translated->save_state(*actual);
+		std::vector<std::string> diff = format_state_diff(*expected, *actual, 12);
+		if (!diff.empty()) {
+			std::printf("frame %d differs, translated against interpreted:\n", frame);
+			for (const std::string& line : diff) {
+				std::printf("    %s\n", line.c_str());
+			}
+			return 1;
+		}
+	}
+	std::printf("%d frames identical%s\n", frames,
+		translated->get_compiled() == nullptr ? ", translation dropped after code was written" : "");
+
+	double plain = timed_run(rom, *start, compiled->quirks, nullptr, frames, instructions);
+	double fast = timed_run(rom, *start, compiled->quirks, compiled, frames, instructions);
+	double executed = static_cast<double>(frames) * instructions;
+	std::printf("interpreted %.3f s, %.1f M instructions/s\n", plain, executed / plain / 1e6);
+	std::printf("translated  %.3f s, %.1f M instructions/s, %.2fx\n", fast, executed / fast / 1e6, plain / fast);
+	return 0;
+}
@@ -0,0 +1,156 @@
+// Runs many Chip8 instances of one rom side by side and reports throughput,
+// memory per instance and, on Linux, the cache miss rate of the run, once
+// with every instance holding a private copy of memory and once with all of
+// them reading from a SharedRom.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/batch_bench.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o batch_bench
+//
+// Usage:
+//   batch_bench <rom> [instances=4096] [frames=600] [instructions per frame=10]
+#include "chip8.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// hardware cache counters for the calling thread, reads 0 when unavailable
+class CacheCounters {
+private:
+	int references;
+	int misses;
+
+	static int open_counter(std::uint64_t config, int group) {
+#ifdef __linux__
+		perf_event_attr attr = {};
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = config;
+		attr.disabled = group < 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+#else
+		return -1;
+#endif
+	}
+
+	static std::uint64_t read_counter(int fd) {
+		std::uint64_t value = 0;
+#ifdef __linux__
+		if (fd >= 0 && ::read(fd, &value, sizeof(value)) != sizeof(value)) {
+			value = 0;
+		}
+#endif
+		return value;
+	}
+
+public:
+	CacheCounters() {
+		references = open_counter(PERF_COUNT_HW_CACHE_REFERENCES, -1);
+		misses = open_counter(PERF_COUNT_HW_CACHE_MISSES, references);
+	}
+
+	~CacheCounters() {
+#ifdef __linux__
+		if (misses >= 0) close(misses);
+		if (references >= 0) close(references);
+#endif
+	}
+
+	bool available() const {
+		return references >= 0 && misses >= 0;
+	}
+
+	void start() {
+#ifdef __linux__
+		if (available()) {
+			ioctl(references, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(references, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+#endif
+	}
+
+	void stop(std::uint64_t& total, std::uint64_t& missed) {
+#ifdef __linux__
+		if (available()) {
+			ioctl(references, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		}
+#endif
+		total = read_counter(references);
+		missed = read_counter(misses);
+	}
+};
+
+void run_batch(const char* label, std::vector<std::unique_ptr<Chip8>>& machines, int frames, int instructions) {
+	CacheCounters counters;
+	counters.start();
+	auto begin = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frames; frame++) {
+		for (std::unique_ptr<Chip8>& machine : machines) {
+			machine->run_frame(instructions);
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	std::uint64_t references, misses;
+	counters.stop(references, misses);
+
+	std::size_t bytes = 0;
+	for (std::unique_ptr<Chip8>& machine : machines) {
+		bytes += machine->get_private_bytes();
+	}
+	double executed = double(machines.size()) * frames * instructions;
+	std::printf("%-8s %8.1f Minstr/s  %6zu bytes/instance", label, executed / seconds / 1e6, bytes / machines.size());
+	if (counters.available() && references > 0) {
+		std::printf("  %5.2f%% cache misses (%llu of %llu)", 100.0 * misses / references,
+			static_cast<unsigned long long>(misses), static_cast<unsigned long long>(references));
+	}
+	else {
+		std::printf("  cache counters unavailable");
+	}
+	std::printf("\n");
+}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s <rom> [instances] [frames] [instructions per frame]\n", argv[0]);
+		return 1;
+	}
+	int instances = argc > 2 ? std::atoi(argv[2]) : 4096;
+	int frames = argc > 3 ? std::atoi(argv[3]) : 600;
+	int instructions = argc > 4 ? std::atoi(argv[4]) : 10;
+
+	std::ifstream file(argv[1], std::ios::binary);
+	std::vector<std::uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	SharedRom shared;
+	if (!file.is_open() || !shared.load(rom.data(), rom.size())) {
+		std::fprintf(stderr, "%s: could not load rom\n", argv[1]);
+		return 1;
+	}
+
+	std::vector<std::unique_ptr<Chip8>> machines;
+	for (int i = 0; i < instances; i++) {
+		machines.emplace_back(new Chip8());
+		machines.back()->load_rom(rom.data(), rom.size());
+	}
+	run_batch("private", machines, frames, instructions);
+
+	machines.clear();
+	for (int i = 0; i < instances; i++) {
+		machines.emplace_back(new Chip8(shared));
+	}
+	run_batch("shared", machines, frames, instructions);
+	return 0;
+}
@@ -0,0 +1,254 @@
+// Conformance runner: runs test roms headlessly for a fixed number of frames
+// and compares a hash of the final display against the golden recorded in a
+// manifest, and measures each rom's throughput against the rate recorded
+// with it, so a change that breaks an instruction or slows the core fails
+// the same run.
+//
+// Manifest lines, paths relative to the manifest, '#' starts a comment:
+//
+//   <rom> <frames> <ipf|rom> <quirks|rom> <setup|-> <display hash|-> <M instr/s|->
+//
+// setup is a comma separated list of kK@A-B, hold key K from frame A until
+// frame B, and mADDR=VV, poke a byte before the first frame (hex). Random
+// numbers are seeded the same on every run. With -u the measured hashes and
+// rates are written back into the manifest; without it a rom that has no
+// hash recorded yet fails, so a manifest of blanks cannot pass.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/conformance.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o conformance
+//
+// Usage:
+//   conformance [-u] [-t slowest fraction of recorded rate=0.5] <manifest>
+//
+// tools/roms/conformance.txt checks the hand-written roms kept in the tree,
+// tools/conformance.txt the external test suite.
+#include "chip8.h"
+#include "hash.h"
+#include "romdb.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+struct KeyHold {
+	int key;
+	int first;
+	int last;
+};
+
+struct Poke {
+	std::uint16_t address;
+	std::uint8_t value;
+};
+
+struct Test {
+	int line;                   // in the manifest
+	std::string rom;
+	int frames;
+	std::string ipf;            // a number, or "rom" for the rom's own settings
+	std::string quirks;         // a profile name, or "rom"
+	std::string setup;
+	std::vector<KeyHold> keys;
+	std::vector<Poke> pokes;
+	std::string hash;           // "-" until recorded
+	std::string rate;
+};
+
+bool parse_setup(Test& test) {
+	if (test.setup == "-") {
+		return true;
+	}
+	std::stringstream items(test.setup);
+	std::string item;
+	while (std::getline(items, item, ',')) {
+		KeyHold hold;
+		unsigned address, value;
+		if (std::sscanf(item.c_str(), "k%x@%d-%d", &hold.key, &hold.first, &hold.last) == 3 && hold.key < 16) {
+			test.keys.push_back(hold);
+		}
+		else if (std::sscanf(item.c_str(), "m%x=%x", &address, &value) == 2 && address < 65536 && value < 256) {
+			test.pokes.push_back({ static_cast<std::uint16_t>(address), static_cast<std::uint8_t>(value) });
+		}
+		else {
+			return false;
+		}
+	}
+	return true;
+}
+
+// one run from power on; returns the display hash, cycles and seconds
+bool run(const Test& test, const std::vector<std::uint8_t>& rom, std::uint64_t& hash, std::uint64_t& cycles, double& seconds) {
+	std::unique_ptr<Chip8> chip8(new Chip8());
+	if (!chip8->load_rom(rom.data(), rom.size())) {
+		return false;
+	}
+	chip8->seed(1);
+	if (test.quirks != "rom") {
+		QuirkProfile quirks;
+		if (!parse_quirk_profile(test.quirks, quirks)) {
+			return false;
+		}
+		chip8->set_quirk_profile(quirks);
+	}
+	int instructions = test.ipf == "rom" ? chip8->get_settings().instructions_per_frame : std::atoi(test.ipf.c_str());
+	chip8->set_timing_mode(instructions == 0 ? TimingMode::CosmacVip : TimingMode::Instructions);
+	if (!test.pokes.empty()) {
+		std::unique_ptr<Chip8State> state(new Chip8State());
+		chip8->save_state(*state);
+		for (const Poke& poke : test.pokes) {
+			state->memory[poke.address] = poke.value;
+		}
+		chip8->load_state(*state);
+	}
+
+	auto begin = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < test.frames; frame++) {
+		for (const KeyHold& hold : test.keys) {
+			if (frame == hold.first) {
+				chip8->press_key(hold.key);
+			}
+			else if (frame == hold.last) {
+				chip8->release_key(hold.key);
+			}
+		}
+		chip8->run_frame(instructions);
+	}
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	// every row of both planes, whatever the resolution
+	hash = 0xCBF29CE484222325ULL;
+	for (int y = 0; y < 64; y++) {
+		hash = hash_bytes(chip8->get_row(y), 4 * sizeof(std::uint64_t), hash);
+	}
+	cycles = chip8->get_cycles();
+	return true;
+}
+}
+
+int main(int argc, char* argv[]) {
+	bool update = false;
+	double tolerance = 0.5;
+	const char* manifest_path = nullptr;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "-u") == 0) {
+			update = true;
+		}
+		else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			tolerance = std::atof(argv[++i]);
+		}
+		else {
+			manifest_path = argv[i];
+		}
+	}
+	if (manifest_path == nullptr) {
+		std::fprintf(stderr, "usage: %s [-u] [-t fraction] <manifest>\n", argv[0]);
+		return 1;
+	}
+	std::ifstream manifest(manifest_path);
+	if (!manifest.is_open()) {
+		std::fprintf(stderr, "%s: cannot open manifest\n", manifest_path);
+		return 1;
+	}
+	std::string directory = manifest_path;
+	directory = directory.find('/') == std::string::npos ? "" : directory.substr(0, directory.find_last_of('/') + 1);
+
+	std::vector<std::string> lines;
+	std::vector<Test> tests;
+	for (std::string line; std::getline(manifest, line);) {
+		lines.push_back(line);
+		std::istringstream fields(line.substr(0, line.find('#')));
+		Test test;
+		test.line = static_cast<int>(lines.size());
+		if (!(fields >> test.rom)) {
+			continue;
+		}
+		if (!(fields >> test.frames >> test.ipf >> test.quirks >> test.setup >> test.hash >> test.rate) || !parse_setup(test)) {
+			std::fprintf(stderr, "%s:%d: expected <rom> <frames> <ipf> <quirks> <setup> <hash> <rate>\n", manifest_path, test.line);
+			return 1;
+		}
+		tests.push_back(test);
+	}
+	manifest.close();
+
+	int failed = 0;
+	for (Test& test : tests) {
+		// a rom can be listed more than once with different setups
+		std::string label = test.setup == "-" ? test.rom : test.rom + " " + test.setup;
+		std::ifstream file(directory + test.rom, std::ios::binary);
+		std::vector<std::uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		std::uint64_t hash, cycles;
+		double seconds;
+		if (!file.is_open() || !run(test, rom, hash, cycles, seconds)) {
+			std::printf("FAIL  %-32s cannot load or run\n", label.c_str());
+			failed++;
+			continue;
+		}
+
+		// a run is a few thousand instructions, repeat it until it is long
+		// enough to time
+		double total_seconds = seconds;
+		std::uint64_t total_cycles = cycles;
+		while (total_seconds < 0.1) {
+			std::uint64_t again_hash, again_cycles;
+			run(test, rom, again_hash, again_cycles, seconds);
+			total_seconds += seconds;
+			total_cycles += again_cycles;
+		}
+		double rate = total_cycles / total_seconds / 1e6;
+
+		char measured[17];
+		std::snprintf(measured, sizeof(measured), "%016" PRIx64, hash);
+		const char* verdict = "pass";
+		if (update) {
+			test.hash = measured;
+			char text[32];
+			std::snprintf(text, sizeof(text), "%.1f", rate);
+			test.rate = text;
+			verdict = "saved";
+		}
+		else if (test.hash == "-") {
+			// nothing to compare against is not a pass, record it with -u
+			verdict = "NONE";
+		}
+		else if (test.hash != measured) {
+			verdict = "FAIL";
+		}
+		else if (test.rate != "-" && rate < std::atof(test.rate.c_str()) * tolerance) {
+			verdict = "SLOW";
+		}
+		failed += std::strcmp(verdict, "pass") != 0 && std::strcmp(verdict, "saved") != 0;
+		std::printf("%-5s %-32s %s%s%s  %8.1f M instr/s%s%s\n", verdict, label.c_str(), measured,
+			verdict[0] == 'F' ? ", expected " : "", verdict[0] == 'F' ? test.hash.c_str() : "", rate,
+			test.rate != "-" && !update ? ", recorded " : "", test.rate != "-" && !update ? test.rate.c_str() : "");
+	}
+
+	if (update) {
+		// only the hash and rate columns change, comments and spacing elsewhere stay
+		for (const Test& test : tests) {
+			char line[512];
+			std::snprintf(line, sizeof(line), "%-24s %6d %4s %-7s %-16s %s %s", test.rom.c_str(), test.frames, test.ipf.c_str(),
+				test.quirks.c_str(), test.setup.c_str(), test.hash.c_str(), test.rate.c_str());
+			std::string& original = lines[test.line - 1];
+			std::size_t comment = original.find('#');
+			lines[test.line - 1] = line + (comment == std::string::npos ? "" : "  " + original.substr(comment));
+		}
+		std::ofstream out(manifest_path);
+		for (const std::string& line : lines) {
+			out << line << '\n';
+		}
+		if (!out) {
+			std::fprintf(stderr, "%s: cannot write manifest\n", manifest_path);
+			return 1;
+		}
+	}
+	std::printf("%zu roms, %d failed\n", tests.size(), failed);
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+// Terminal debugger: runs a rom headlessly under a Debugger and takes one
+// command per line. The machine starts stopped at 0x200.
+//
+//   b <addr>          toggle a breakpoint
+//   w <addr>          toggle a watchpoint on writes to addr
+//   c [frames=3600]   continue until something stops it or the frames run out
+//   s                 step one instruction
+//   n                 step over, a 2nnn runs until the routine returns
+//   r                 registers and stack
+//   l [addr]          disassemble from addr, or around pc
+//   m <addr> [rows]   memory, 8 bytes per row
+//   k <key> <0|1>     release or hold a keypad key
+//   q                 quit
+//
+// Addresses are hex. Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/debug.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o debug
+//
+// Usage:
+//   debug <rom>
+#include "chip8.h"
+#include "debugger.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+void print(const std::vector<std::string>& lines) {
+	for (const std::string& line : lines) {
+		std::printf("%s\n", line.c_str());
+	}
+}
+
+void show_stop(Chip8& chip8, const Debugger& debugger, const Chip8State& state) {
+	HaltReason reason = chip8.get_halt_reason();
+	if (reason == HaltReason::Break && debugger.get_stop_cause() == StopCause::Watchpoint) {
+		std::printf("stopped: write to %04X\n", debugger.get_watch_hit());
+	}
+	else if (reason == HaltReason::Break) {
+		std::printf("stopped: %s\n", stop_cause_name(debugger.get_stop_cause()));
+	}
+	else if (reason != HaltReason::None) {
+		std::printf("halted: %s\n", halt_reason_name(reason));
+	}
+	print(format_disassembly(state, state.pc, 1, debugger));
+}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s <rom>\n", argv[0]);
+		return 1;
+	}
+	std::unique_ptr<Chip8> chip8(new Chip8());
+	if (!chip8->load_rom(argv[1])) {
+		std::fprintf(stderr, "%s: could not load rom\n", argv[1]);
+		return 1;
+	}
+	Debugger debugger;
+	chip8->set_observer(&debugger);
+	debugger.pause(*chip8);
+
+	// 64 KB, refreshed after every command that can change the machine
+	std::unique_ptr<Chip8State> state(new Chip8State());
+	chip8->save_state(*state);
+	show_stop(*chip8, debugger, *state);
+
+	std::string line;
+	while (std::printf("> "), std::fflush(stdout), std::getline(std::cin, line)) {
+		std::istringstream words(line);
+		std::string command;
+		words >> command;
+		unsigned address = 0;
+		if (command == "q") {
+			break;
+		}
+		else if (command == "b" && words >> std::hex >> address) {
+			debugger.set_breakpoint(address, !debugger.has_breakpoint(address));
+			std::printf("breakpoint %04X %s\n", address, debugger.has_breakpoint(address) ? "set" : "cleared");
+		}
+		else if (command == "w" && words >> std::hex >> address) {
+			debugger.set_watchpoint(address, !debugger.has_watchpoint(address));
+			std::printf("watchpoint %04X %s\n", address, debugger.has_watchpoint(address) ? "set" : "cleared");
+		}
+		else if (command == "c" || command == "s" || command == "n") {
+			if (command == "s") {
+				debugger.step(*chip8);
+			}
+			else if (command == "n") {
+				debugger.step_over(*chip8);
+			}
+			else {
+				debugger.resume(*chip8);
+			}
+			// a step over a call, or a continue, runs whole frames until stopped
+			int frames = 3600;
+			words >> frames;
+			int instructions = chip8->get_settings().instructions_per_frame;
+			for (int i = 0; i < frames && chip8->get_halt_reason() == HaltReason::None; i++) {
+				chip8->run_frame(instructions);
+			}
+			if (chip8->get_halt_reason() == HaltReason::None) {
+				debugger.pause(*chip8);
+			}
+			chip8->save_state(*state);
+			show_stop(*chip8, debugger, *state);
+		}
+		else if (command == "r") {
+			print(format_registers(*state));
+			std::printf("%s\n", format_stack(*state).c_str());
+		}
+		else if (command == "l") {
+			if (!(words >> std::hex >> address)) {
+				address = state->pc >= 8 ? state->pc - 8 : 0;
+			}
+			print(format_disassembly(*state, address, 12, debugger));
+		}
+		else if (command == "m" && words >> std::hex >> address) {
+			int rows = 4;
+			words >> std::dec >> rows;
+			print(format_memory(*state, address, rows));
+		}
+		else if (command == "k" && words >> std::hex >> address) {
+			int held = 0;
+			words >> held;
+			if (held) {
+				chip8->press_key(address & 0xF);
+			}
+			else {
+				chip8->release_key(address & 0xF);
+			}
+		}
+		else if (!command.empty()) {
+			std::printf("commands: b w c s n r l m k q, see tools/debug.cpp\n");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,278 @@
+// Differential test of every way this tree can run a rom. Each rom runs
+// with the same seed and the same scripted key presses through:
+//
+//   interpreter  the normal frame loop, which skips idle loops; the reference
+//   observed     the observed interpreter with an idle Debugger, no skipping
+//   shared       an instance reading its memory from a SharedRom, as batches do
+//   snapshot     two machines taking turns, handing over through save/load_state
+//   stepped      emulate_cycle one instruction at a time, as single stepping does
+//   translated   the rom's tools/recompile translation, when one is linked in
+//
+// The full machine state of every engine is compared with the reference every
+// few frames, and a rom stops at its first divergence with a diff of the two
+// states. Roms are spread over worker threads.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -pthread -iquote source tools/difftest.cpp source/chip8.cpp source/compiled.cpp source/rompack.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o difftest
+// adding any translations from tools/recompile to the command line.
+//
+// Usage:
+//   difftest [-f frames=600] [-i instructions per frame=rom's] [-s seed=1] [-e compare every=1] [-j threads] <rom or .pack>...
+//
+// tools/roms holds small hand-written roms, run them all with
+// difftest tools/roms/*.ch8; besides those tools/roms/conformance.txt
+// describes, there are cases that broke before:
+//   timer-wait-high  an Fx07, 3x00, 1nnn wait at 0x1200, past what 1nnn reaches
+#include "analyzer.h"
+#include "chip8.h"
+#include "compiled.h"
+#include "debugger.h"
+#include "rompack.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+struct Rom {
+	std::string name;
+	std::vector<std::uint8_t> data;
+};
+
+struct Options {
+	int frames = 600;
+	int instructions = 0;  // 0 takes the rom's own
+	std::uint32_t seed = 1;
+	int every = 1;
+};
+
+enum class EngineKind {
+	Interpreter,
+	Observed,
+	Shared,
+	Snapshot,
+	Stepped,
+	Translated
+};
+
+const char* const engine_names[] = { "interpreter", "observed", "shared", "snapshot", "stepped", "translated" };
+
+struct Engine {
+	EngineKind kind;
+	std::unique_ptr<Chip8> machine;
+	std::unique_ptr<Chip8> spare;         // snapshot's other machine
+	std::unique_ptr<Chip8State> handover;
+	Debugger debugger;
+};
+
+// a key pressed or released every few frames, somewhere inside the frame
+int frame_events(std::uint32_t seed, int frame, int spread, std::uint64_t cycles, KeyEvent& event) {
+	std::uint32_t mix = (static_cast<std::uint32_t>(frame) + seed * 7919u) * 2654435761u;
+	if (mix % 5 != 0) {
+		return 0;
+	}
+	event.cycle = cycles + (mix >> 8) % static_cast<std::uint32_t>(spread);
+	event.key = (mix >> 4) & 0xF;
+	event.pressed = (mix >> 16) & 1;
+	return 1;
+}
+
+// the machine every engine but shared starts from: the rom loaded and
+// analyzed, then seeded
+std::unique_ptr<Chip8> load(const Rom& rom, std::uint32_t seed, RomAnalysis* analysis) {
+	std::unique_ptr<Chip8> chip8(new Chip8());
+	chip8->set_analysis(analysis);
+	if (!chip8->load_rom(rom.data.data(), rom.data.size())) {
+		return nullptr;
+	}
+	chip8->seed(seed);
+	return chip8;
+}
+
+void run_frame(Engine& engine, int instructions, const KeyEvent* events, int count) {
+	Chip8& chip8 = *engine.machine;
+	switch (engine.kind) {
+	case EngineKind::Snapshot:
+		chip8.run_frame(instructions, events, count);
+		chip8.save_state(*engine.handover);
+		engine.spare->load_state(*engine.handover);
+		std::swap(engine.machine, engine.spare);
+		break;
+	case EngineKind::Stepped:
+	{
+		// emulate_cycle never skips idle loops and has no events, they are
+		// applied here at the same cycles the frame loop would
+		int next = 0;
+		for (int i = 0; i < instructions && chip8.get_halt_reason() == HaltReason::None; i++) {
+			for (; next < count && events[next].cycle <= chip8.get_cycles(); next++) {
+				events[next].pressed ? chip8.press_key(events[next].key) : chip8.release_key(events[next].key);
+			}
+			chip8.emulate_cycle();
+		}
+		for (; next < count; next++) {
+			events[next].pressed ? chip8.press_key(events[next].key) : chip8.release_key(events[next].key);
+		}
+		chip8.step_timers();
+		break;
+	}
+	default:
+		chip8.run_frame(instructions, events, count);
+	}
+}
+
+// runs one rom through every engine, returns the report
+std::string test(const Rom& rom, const Options& options, const SharedRom* shared, RomAnalysis* analysis) {
+	std::unique_ptr<Chip8> reference = load(rom, options.seed, analysis);
+	if (reference == nullptr) {
+		return "skipped " + rom.name + ": does not fit in memory\n";
+	}
+	TimingMode timing = reference->get_timing_mode();
+	int instructions = options.instructions > 0 ? options.instructions : reference->get_settings().instructions_per_frame;
+
+	// engines are held by pointer, the observed one's Debugger must not move
+	std::vector<std::unique_ptr<Engine>> engines;
+	auto add = [&](EngineKind kind) -> Engine& {
+		engines.emplace_back(new Engine());
+		engines.back()->kind = kind;
+		engines.back()->machine = load(rom, options.seed, analysis);
+		return *engines.back();
+	};
+	Engine& observed = add(EngineKind::Observed);
+	observed.machine->set_observer(&observed.debugger);
+	Engine& batch = add(EngineKind::Shared);
+	batch.machine.reset(new Chip8(*shared));
+	batch.machine->seed(options.seed);
+	Engine& snapshot = add(EngineKind::Snapshot);
+	snapshot.spare = load(rom, options.seed, analysis);
+	snapshot.handover.reset(new Chip8State());
+	add(EngineKind::Stepped);
+	const char* translation = "";
+	const CompiledRom* compiled = find_compiled_rom(reference->get_rom_hash());
+	if (compiled != nullptr) {
+		Engine& translated = add(EngineKind::Translated);
+		translation = " including the translation";
+		if (timing != TimingMode::Instructions || !translated.machine->set_compiled(compiled)) {
+			translation = ", translation not usable with this rom's settings";
+			engines.pop_back();
+		}
+	}
+
+	std::unique_ptr<Chip8State> expected(new Chip8State());
+	std::unique_ptr<Chip8State> actual(new Chip8State());
+	int spread = instructions > 0 ? instructions : 20;
+	for (int frame = 0; frame < options.frames; frame++) {
+		KeyEvent event;
+		int count = frame_events(options.seed, frame, spread, reference->get_cycles(), event);
+		reference->run_frame(instructions, &event, count);
+		for (std::unique_ptr<Engine>& engine : engines) {
+			run_frame(*engine, instructions, &event, count);
+		}
+		if ((frame + 1) % options.every != 0 && frame + 1 != options.frames) {
+			continue;
+		}
+		reference->save_state(*expected);
+		for (std::unique_ptr<Engine>& engine : engines) {
+			engine->machine->save_state(*actual);
+			std::vector<std::string> diff = format_state_diff(*expected, *actual, 12);
+			if (diff.empty()) {
+				continue;
+			}
+			char line[160];
+			std::snprintf(line, sizeof(line), "DIVERGED %s: %s after frame %d, cycle %llu\n", rom.name.c_str(),
+				engine_names[static_cast<int>(engine->kind)], frame, static_cast<unsigned long long>(expected->cycles));
+			std::string report = line;
+			for (const std::string& difference : diff) {
+				report += "    " + difference + "\n";
+			}
+			return report;
+		}
+	}
+	char line[160];
+	std::snprintf(line, sizeof(line), "ok %s: %zu engines agree over %d frames%s\n", rom.name.c_str(), engines.size(),
+		options.frames, translation);
+	return line;
+}
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<Rom> roms;
+	std::vector<std::unique_ptr<RomPack>> packs;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc) {
+			int value = std::atoi(argv[++i]);
+			switch (arg[1]) {
+			case 'f': options.frames = value; break;
+			case 'i': options.instructions = value; break;
+			case 's': options.seed = static_cast<std::uint32_t>(std::strtoul(argv[i], nullptr, 0)); break;
+			case 'e': options.every = std::max(1, value); break;
+			case 'j': threads = std::max(1, value); break;
+			default:
+				std::fprintf(stderr, "%s: unknown option\n", arg.c_str());
+				return 1;
+			}
+			continue;
+		}
+		if (arg.size() > 5 && arg.compare(arg.size() - 5, 5, ".pack") == 0) {
+			std::unique_ptr<RomPack> pack(new RomPack());
+			if (!pack->open(arg)) {
+				std::fprintf(stderr, "%s: not a valid rom pack\n", arg.c_str());
+				return 1;
+			}
+			for (int j = 0; j < pack->size(); j++) {
+				roms.push_back({ pack->name(j), std::vector<std::uint8_t>(pack->data(j), pack->data(j) + pack->rom_size(j)) });
+			}
+			continue;
+		}
+		std::ifstream file(arg, std::ios::binary);
+		if (!file.is_open()) {
+			std::fprintf(stderr, "%s: could not load rom\n", arg.c_str());
+			return 1;
+		}
+		roms.push_back({ arg, std::vector<std::uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()) });
+	}
+	if (roms.empty()) {
+		std::fprintf(stderr, "usage: %s [-f frames] [-i instructions] [-s seed] [-e every] [-j threads] <rom or .pack>...\n", argv[0]);
+		return 1;
+	}
+
+	// each worker takes the next untested rom; reports print in rom order
+	std::vector<std::string> reports(roms.size());
+	std::atomic<std::size_t> next(0);
+	auto work = [&]() {
+		std::unique_ptr<SharedRom> shared(new SharedRom());
+		std::unique_ptr<RomAnalysis> analysis(new RomAnalysis());
+		for (std::size_t i = next++; i < roms.size(); i = next++) {
+			if (!shared->load(roms[i].data.data(), roms[i].data.size(), nullptr, analysis.get())) {
+				reports[i] = "skipped " + roms[i].name + ": does not fit in memory\n";
+				continue;
+			}
+			reports[i] = test(roms[i], options, shared.get(), analysis.get());
+		}
+	};
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++) {
+		workers.emplace_back(work);
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	int diverged = 0;
+	for (const std::string& report : reports) {
+		std::fputs(report.c_str(), stdout);
+		diverged += report.compare(0, 8, "DIVERGED") == 0;
+	}
+	std::printf("%zu roms, %d diverged\n", roms.size(), diverged);
+	return diverged == 0 ? 0 : 1;
+}
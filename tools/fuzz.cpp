@@ -0,0 +1,439 @@
+// Fuzz target for the rom loader and the core. Each input is a rom plus how
+// to run it, and one machine is reused for every input since load_rom starts
+// it from power on, so an execution costs little more than the instructions
+// it runs.
+//
+// Input layout:
+//   0     quirk profile, modulo the five
+//   1     instructions per frame, 0 runs with vip timing
+//   2     bits 0-3 frames - 1, bit 4 steps with emulate_cycle, bit 5 hands the
+//         machine over through save/load_state every frame, bit 6 runs under
+//         a Debugger, bit 7 resumes past faults
+//   3-4   address of the Debugger's breakpoint and watchpoint, big endian
+//   5     key events, modulo 9, then 3 bytes each: frame, key | pressed << 4,
+//         cycle within the frame
+//   rest  the rom
+//
+// Inputs go up to 65054 bytes, the longest header and the largest rom
+// load_rom takes, so roms reach past 4 KB where only XO-CHIP code runs;
+// give libFuzzer the same -max_len=65054. With libFuzzer, which also
+// minimizes crashes (-minimize_crash=1 -runs=N):
+//   clang++ -g -O1 -std=gnu++17 -fsanitize=fuzzer,address,undefined -iquote source tools/fuzz.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o fuzz
+// AFL++ builds the same line with afl-clang-fast++. Where neither is around,
+// -DFUZZ_STANDALONE adds a main with a plain mutator that saves crashing or
+// hanging inputs, replays them and minimizes them:
+//   g++ -g -O1 -std=gnu++17 -fsanitize=address,undefined -DFUZZ_STANDALONE -pthread -iquote source tools/fuzz.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o fuzz
+//
+// Usage (standalone):
+//   fuzz [-n runs=forever] [-s seed=1] [-t hang seconds=5] [-o output dir=.] [seed inputs...]
+//   fuzz -r <input>...   replay
+//   fuzz -m <input>      minimize into <input>.min, each attempt in a child process
+#include "analyzer.h"
+#include "chip8.h"
+#include "debugger.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace {
+// the longest header and the largest rom load_rom takes
+constexpr std::size_t MAX_INPUT = 6 + 8 * 3 + 65024;
+
+struct Machines {
+	Chip8 chip8;
+	Chip8 spare;  // the other side of a save/load_state handover
+	Chip8State handover;
+	Debugger debugger;
+	RomAnalysis analysis;  // shared by both loads, inputs stay allocation free
+
+	Machines() {
+		chip8.set_analysis(&analysis);
+		spare.set_analysis(&analysis);
+	}
+};
+
+// the last state reached, for the standalone mutator to tell inputs apart
+std::uint64_t outcome;
+
+void run_input(const std::uint8_t* data, std::size_t size) {
+	static Machines* machines = new Machines();
+	if (size < 6 || size < 6 + data[5] % 9 * 3u) {
+		return;
+	}
+	QuirkProfile quirks = static_cast<QuirkProfile>(data[0] % 5);
+	int instructions = data[1];
+	int frames = (data[2] & 0xF) + 1;
+	bool stepped = data[2] & 0x10;
+	bool handover = data[2] & 0x20;
+	bool observed = data[2] & 0x40;
+	bool resume = data[2] & 0x80;
+	std::uint16_t watched = data[3] << 8 | data[4];
+	int event_count = data[5] % 9;
+	const std::uint8_t* events = data + 6;
+	const std::uint8_t* rom = events + event_count * 3;
+	std::size_t rom_size = size - (rom - data);
+
+	Chip8* chip8 = &machines->chip8;
+	Chip8* spare = &machines->spare;
+	if (!chip8->load_rom(rom, rom_size)) {
+		return;
+	}
+	chip8->seed(1);
+	chip8->set_quirk_profile(quirks);
+	chip8->set_timing_mode(instructions == 0 ? TimingMode::CosmacVip : TimingMode::Instructions);
+	Debugger& debugger = machines->debugger;
+	debugger.clear();
+	if (observed) {
+		debugger.set_breakpoint(watched, true);
+		debugger.set_watchpoint(watched, true);
+		chip8->set_observer(&debugger);
+	}
+	else {
+		chip8->clear_observer();
+	}
+	if (handover) {
+		spare->load_rom(rom, rom_size);
+		spare->set_quirk_profile(quirks);
+		spare->set_timing_mode(chip8->get_timing_mode());
+		observed ? spare->set_observer(&debugger) : spare->clear_observer();
+	}
+
+	for (int frame = 0; frame < frames; frame++) {
+		KeyEvent frame_events[8];
+		int count = 0;
+		for (int i = 0; i < event_count; i++) {
+			const std::uint8_t* event = events + i * 3;
+			if (event[0] % frames == frame) {
+				frame_events[count++] = { chip8->get_cycles() + event[2], static_cast<std::uint8_t>(event[1] & 0xF), (event[1] & 0x10) != 0 };
+			}
+		}
+		if (stepped) {
+			int next = 0;
+			for (int i = 0; i < (instructions == 0 ? 20 : instructions) && chip8->get_halt_reason() == HaltReason::None; i++) {
+				for (; next < count && frame_events[next].cycle <= chip8->get_cycles(); next++) {
+					frame_events[next].pressed ? chip8->press_key(frame_events[next].key) : chip8->release_key(frame_events[next].key);
+				}
+				chip8->emulate_cycle();
+			}
+			chip8->step_timers();
+		}
+		else {
+			chip8->run_frame(instructions, frame_events, count);
+		}
+		if (handover) {
+			chip8->save_state(machines->handover);
+			spare->load_state(machines->handover);
+			Chip8* swap = chip8;
+			chip8 = spare;
+			spare = swap;
+		}
+		if (chip8->get_halt_reason() == HaltReason::Break) {
+			debugger.resume(*chip8);
+		}
+		else if (resume) {
+			chip8->resume(true);
+		}
+	}
+	outcome = static_cast<std::uint64_t>(chip8->get_halt_reason()) << 16 | chip8->get_pc();
+}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size) {
+	run_input(data, size);
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+#include "hash.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern "C" void __sanitizer_set_death_callback(void (*callback)()) __attribute__((weak));
+
+namespace {
+std::vector<std::uint8_t> current;    // the input running now
+std::atomic<std::uint64_t> executions(0);
+std::string output = ".";
+
+// saves the running input as <output>/<kind>-<hash>, only async signal safe
+// calls so it can run from a signal handler
+void save_current(const char* kind) {
+	char path[4096];
+	std::size_t length = 0;
+	auto append = [&](const char* text) {
+		for (; *text != '\0' && length < sizeof(path) - 1; text++) {
+			path[length++] = *text;
+		}
+	};
+	append(output.c_str());
+	append("/");
+	append(kind);
+	append("-");
+	std::uint64_t hash = hash_bytes(current.data(), current.size());
+	char digits[17];
+	for (int i = 0; i < 16; i++) {
+		digits[i] = "0123456789abcdef"[hash >> (60 - i * 4) & 0xF];
+	}
+	digits[16] = '\0';
+	append(digits);
+	path[length] = '\0';
+	int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file >= 0) {
+		ssize_t written = write(file, current.data(), current.size());
+		(void)written;
+		close(file);
+		static const char note[] = "input saved to ";
+		written = write(2, note, sizeof(note) - 1);
+		written = write(2, path, length);
+		written = write(2, "\n", 1);
+	}
+}
+
+void on_death() {
+	save_current("crash");
+}
+
+void on_signal(int signal) {
+	save_current("crash");
+	std::signal(signal, SIG_DFL);
+	std::raise(signal);
+}
+
+std::vector<std::uint8_t> read_file(const char* path) {
+	std::ifstream file(path, std::ios::binary);
+	return std::vector<std::uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+// runs the input in a child process, true when it crashed or hung
+bool fails(const std::vector<std::uint8_t>& input, int hang_seconds) {
+	pid_t child = fork();
+	if (child == 0) {
+		alarm(hang_seconds);
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, 2);
+		run_input(input.data(), input.size());
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(child, &status, 0);
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int minimize(const char* path, int hang_seconds) {
+	std::vector<std::uint8_t> input = read_file(path);
+	if (!fails(input, hang_seconds)) {
+		std::fprintf(stderr, "%s: runs cleanly, nothing to minimize\n", path);
+		return 1;
+	}
+	// key events first, each one goes with the count in the header; then
+	// ever smaller chunks while it still fails, then zero what is left so the
+	// bytes that matter stand out
+	for (int event = 0; input.size() >= 6 && event < input[5] % 9;) {
+		std::vector<std::uint8_t> candidate(input);
+		candidate[5] = input[5] % 9 - 1;
+		candidate.erase(candidate.begin() + 6 + event * 3, candidate.begin() + 9 + event * 3);
+		if (fails(candidate, hang_seconds)) {
+			input.swap(candidate);
+		}
+		else {
+			event++;
+		}
+	}
+	for (std::size_t chunk = input.size() / 2; chunk > 0; chunk /= 2) {
+		for (std::size_t at = 0; at + chunk <= input.size();) {
+			std::vector<std::uint8_t> candidate(input);
+			candidate.erase(candidate.begin() + at, candidate.begin() + at + chunk);
+			if (fails(candidate, hang_seconds)) {
+				input.swap(candidate);
+			}
+			else {
+				at += chunk;
+			}
+		}
+	}
+	for (std::size_t at = 0; at < input.size(); at++) {
+		if (input[at] != 0) {
+			std::vector<std::uint8_t> candidate(input);
+			candidate[at] = 0;
+			if (fails(candidate, hang_seconds)) {
+				input.swap(candidate);
+			}
+		}
+	}
+	std::string out = std::string(path) + ".min";
+	std::ofstream file(out, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(input.data()), input.size());
+	std::printf("%zu bytes left, written to %s\n", input.size(), out.c_str());
+	return 0;
+}
+
+void mutate(std::vector<std::uint8_t>& input, std::mt19937& random) {
+	int edits = 1 + random() % 8;
+	for (int i = 0; i < edits; i++) {
+		std::size_t at = input.empty() ? 0 : random() % input.size();
+		switch (random() % 7) {
+		case 0:
+			if (!input.empty()) {
+				input[at] ^= 1 << (random() % 8);
+			}
+			break;
+		case 1:
+			if (!input.empty()) {
+				input[at] = random();
+			}
+			break;
+		case 2:  // a whole instruction, opcodes are where the branches are
+			input.insert(input.begin() + at, { static_cast<std::uint8_t>(random()), static_cast<std::uint8_t>(random()) });
+			break;
+		case 3:
+			if (!input.empty()) {
+				input.erase(input.begin() + at, input.begin() + std::min(input.size(), at + 1 + random() % 4));
+			}
+			break;
+		case 4:  // a duplicated stretch, loops and calls into it
+			if (!input.empty()) {
+				std::size_t length = std::min<std::size_t>(input.size() - at, 1 + random() % 16);
+				std::vector<std::uint8_t> copy(input.begin() + at, input.begin() + at + length);
+				input.insert(input.begin() + random() % (input.size() + 1), copy.begin(), copy.end());
+			}
+			break;
+		case 5:  // a long stretch of zeros, code after it lands past 4 KB
+			input.insert(input.begin() + at, random() % 8192, 0);
+			break;
+		default:  // the header, how the rom is run
+			if (input.size() >= 6) {
+				input[random() % 6] = random();
+			}
+		}
+	}
+	if (input.size() > MAX_INPUT) {
+		input.resize(MAX_INPUT);
+	}
+}
+}
+
+int main(int argc, char* argv[]) {
+	std::uint64_t runs = ~std::uint64_t(0);
+	std::uint32_t seed = 1;
+	int hang_seconds = 5;
+	const char* mode = nullptr;
+	std::vector<std::vector<std::uint8_t>> corpus;
+	std::vector<const char*> paths;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "-r" || arg == "-m") && mode == nullptr) {
+			mode = argv[i];
+		}
+		else if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc) {
+			switch (arg[1]) {
+			case 'n': runs = std::strtoull(argv[++i], nullptr, 0); break;
+			case 's': seed = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 0)); break;
+			case 't': hang_seconds = std::max(1, std::atoi(argv[++i])); break;
+			case 'o': output = argv[++i]; break;
+			default:
+				std::fprintf(stderr, "%s: unknown option\n", arg.c_str());
+				return 1;
+			}
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (mode != nullptr && std::strcmp(mode, "-m") == 0) {
+		if (paths.size() != 1) {
+			std::fprintf(stderr, "usage: %s -m <input>\n", argv[0]);
+			return 1;
+		}
+		return minimize(paths[0], hang_seconds);
+	}
+
+	if (__sanitizer_set_death_callback != nullptr) {
+		__sanitizer_set_death_callback(on_death);
+	}
+	for (int signal : { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT }) {
+		std::signal(signal, on_signal);
+	}
+	if (mode != nullptr) {
+		for (const char* path : paths) {
+			current = read_file(path);
+			run_input(current.data(), current.size());
+			std::printf("%s: ok\n", path);
+		}
+		return 0;
+	}
+
+	// a run that stops making progress is a hang, saved the same way
+	std::thread([hang_seconds]() {
+		std::uint64_t last = executions;
+		for (int still = 0;; std::this_thread::sleep_for(std::chrono::seconds(1))) {
+			std::uint64_t now = executions;
+			still = now == last ? still + 1 : 0;
+			last = now;
+			if (still > hang_seconds) {
+				save_current("hang");
+				_exit(2);
+			}
+		}
+	}).detach();
+
+	for (const char* path : paths) {
+		corpus.push_back(read_file(path));
+	}
+	if (corpus.empty()) {
+		corpus.push_back({ 0, 10, 0x0F, 0x02, 0x00, 0 });
+		// and one that runs on past 4 KB into a timer wait no jump reaches
+		std::vector<std::uint8_t> high = { 4, 255, 0x0F, 0x02, 0x00, 0 };
+		for (int i = 0; i < 0x1000; i++) {
+			high.insert(high.end(), { 0x60, 0x00 });
+		}
+		const std::uint8_t wait[] = { 0xF0, 0x07, 0x30, 0x00, 0x12, 0x00 };
+		std::copy(wait, wait + sizeof(wait), high.begin() + 6 + 0x1000);
+		corpus.push_back(high);
+	}
+
+	// inputs that end somewhere new join the corpus; without coverage
+	// instrumentation the final halt reason and pc stand in for it
+	std::vector<bool> seen(1 << 20);
+	std::mt19937 random(seed);
+	auto begin = std::chrono::steady_clock::now();
+	auto last_report = begin;
+	for (std::uint64_t run = 0; run < runs; run++) {
+		current = corpus[random() % corpus.size()];
+		mutate(current, random);
+		run_input(current.data(), current.size());
+		executions++;
+		std::size_t bucket = hash_bytes(&outcome, sizeof(outcome)) & (seen.size() - 1);
+		if (!seen[bucket]) {
+			seen[bucket] = true;
+			corpus.push_back(current);
+		}
+		if ((run & 0xFFF) == 0) {
+			auto now = std::chrono::steady_clock::now();
+			if (now - last_report > std::chrono::seconds(2)) {
+				double seconds = std::chrono::duration<double>(now - begin).count();
+				std::printf("%llu runs, %.0f/s, corpus %zu\n", static_cast<unsigned long long>(run + 1), (run + 1) / seconds, corpus.size());
+				std::fflush(stdout);
+				last_report = now;
+			}
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	std::printf("%llu runs in %.1f s, %.0f/s, corpus %zu, no crashes\n", static_cast<unsigned long long>(runs), seconds,
+		runs / seconds, corpus.size());
+	return 0;
+}
+#endif
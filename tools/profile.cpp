@@ -0,0 +1,66 @@
+// Profiles a rom headlessly and writes the results the frontend writes when
+// profiling is toggled on: <out>.json with the per address heatmap, opcode
+// histogram and per frame costs, and <out>.folded with call stacks for
+// flamegraph.pl or speedscope. The rom is also run once unprofiled to
+// report what profiling costs.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/profile.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o profile
+//
+// Usage:
+//   profile <rom> [frames=3600] [instructions per frame=10] [out=profile]
+#include "chip8.h"
+#include "profiler.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+double run(const std::vector<std::uint8_t>& rom, int frames, int instructions, Profiler* profiler) {
+	std::unique_ptr<Chip8> chip8(new Chip8());
+	chip8->load_rom(rom.data(), rom.size());
+	if (profiler != nullptr) {
+		chip8->set_observer(profiler);
+	}
+	auto begin = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frames; frame++) {
+		chip8->run_frame(instructions);
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s <rom> [frames] [instructions per frame] [out]\n", argv[0]);
+		return 1;
+	}
+	int frames = argc > 2 ? std::atoi(argv[2]) : 3600;
+	int instructions = argc > 3 ? std::atoi(argv[3]) : 10;
+	std::string out = argc > 4 ? argv[4] : "profile";
+
+	std::ifstream file(argv[1], std::ios::binary);
+	std::vector<std::uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (!file.is_open()) {
+		std::fprintf(stderr, "%s: could not load rom\n", argv[1]);
+		return 1;
+	}
+
+	// the unprofiled run skips idle loops, the profiled one executes them,
+	// so the comparison is per instruction rather than per frame
+	double plain = run(rom, frames, instructions, nullptr);
+	Profiler profiler;
+	double profiled = run(rom, frames, instructions, &profiler);
+	if (!profiler.write_json(out + ".json") || !profiler.write_folded(out + ".folded")) {
+		std::fprintf(stderr, "%s: could not write results\n", out.c_str());
+		return 1;
+	}
+	std::printf("unprofiled %.3f s, profiled %.3f s, %+.1f%%\n", plain, profiled, 100.0 * (profiled - plain) / plain);
+	std::printf("wrote %s.json and %s.folded\n", out.c_str(), out.c_str());
+	return 0;
+}
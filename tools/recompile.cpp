@@ -0,0 +1,559 @@
+// Translates a rom ahead of time into a C++ file that runs it without the
+// interpreter's fetch and decode. Every instruction the analyzer reaches
+// from 0x200 becomes straight-line code on a Chip8State, laid out in basic
+// blocks that jump to each other with goto; a switch on pc enters the code
+// anywhere. What it does not translate is left to the interpreter:
+//
+//   - draws, scrolls, clears, resolution changes, Fx0A and F002
+//   - undefined opcodes, and 2nnn and 00EE when they would fault
+//   - the targets of Bnnn, unless something else reaches them
+//   - blocks the analyzer sees written by Fx33/Fx55
+//
+// Writes that land on translated code at runtime make the Chip8 drop the
+// translation and interpret from then on. The output registers itself by
+// rom hash, link it into a runner such as tools/aot_run.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/recompile.cpp source/analyzer.cpp source/romdb.cpp -o recompile
+//
+// Usage:
+//   recompile <rom> <out.cpp> [quirks=suggested]
+#include "analyzer.h"
+#include "hash.h"
+#include "romdb.h"
+#include <algorithm>
+#include <array>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr std::uint16_t START = 0x200;
+const char* const profile_enumerators[] = { "Legacy", "CosmacVip", "Chip48", "SuperChip", "XoChip" };
+
+// the quirks that change translated code, read once from the profile's Quirks
+struct QuirkValues {
+	bool shift_uses_vy;
+	bool load_store_increments_i;
+	bool jump_uses_vx;
+	bool logic_resets_vf;
+	bool index_overflow_sets_vf;
+};
+
+template <QuirkProfile P>
+QuirkValues values() {
+	return { Quirks<P>::shift_uses_vy, Quirks<P>::load_store_increments_i, Quirks<P>::jump_uses_vx,
+		Quirks<P>::logic_resets_vf, Quirks<P>::index_overflow_sets_vf };
+}
+
+QuirkValues quirk_values(QuirkProfile profile) {
+	switch (profile) {
+	case QuirkProfile::CosmacVip: return values<QuirkProfile::CosmacVip>();
+	case QuirkProfile::Chip48: return values<QuirkProfile::Chip48>();
+	case QuirkProfile::SuperChip: return values<QuirkProfile::SuperChip>();
+	case QuirkProfile::XoChip: return values<QuirkProfile::XoChip>();
+	default: return values<QuirkProfile::Legacy>();
+	}
+}
+
+std::string format(const char* text, ...) {
+	char line[256];
+	va_list args;
+	va_start(args, text);
+	std::vsnprintf(line, sizeof(line), text, args);
+	va_end(args);
+	return line;
+}
+
+struct Translator {
+	std::vector<std::uint8_t> rom;
+	RomAnalysis analysis;
+	QuirkProfile quirks;
+	QuirkValues quirk;
+
+	std::array<bool, 65536> translated = {};  // first byte of every translated instruction
+	std::array<bool, 65536> starts = {};      // where a run of translated instructions begins
+	std::array<std::uint8_t, 8192> code_map = {};
+	std::map<std::uint16_t, int> run_length;  // translated instructions from here to the end of its run
+	bool uses_dispatch = false;
+	std::string body;
+
+	std::uint16_t fetch(std::size_t address) const {
+		if (address < START || address + 1 >= START + rom.size()) {
+			return 0;
+		}
+		return rom[address - START] << 8 | rom[address - START + 1];
+	}
+
+	static int length(std::uint16_t opcode) {
+		return opcode == 0xF000 ? 4 : 2;
+	}
+
+	// everything but what touches the display, waits, or would halt
+	static bool translatable(std::uint16_t opcode) {
+		std::uint16_t x = (opcode & 0x0F00) >> 8;
+		std::uint16_t kk = opcode & 0x00FF;
+		std::uint16_t n = opcode & 0x000F;
+		switch (opcode & 0xF000) {
+		case 0x0000:
+			return opcode == 0x00EE;
+		case 0x5000:
+			return n == 0 || n == 2 || n == 3;
+		case 0x8000:
+			return n <= 7 || n == 0xE;
+		case 0xD000:
+			return false;
+		case 0xE000:
+			return kk == 0x9E || kk == 0xA1;
+		case 0xF000:
+			switch (kk) {
+			case 0x00:
+				return x == 0;
+			case 0x01: case 0x07: case 0x15: case 0x18: case 0x1E: case 0x29: case 0x30:
+			case 0x33: case 0x3A: case 0x55: case 0x65: case 0x75: case 0x85:
+				return true;
+			}
+			return false;
+		default:
+			return true;
+		}
+	}
+
+	static bool ends_run(std::uint16_t opcode) {
+		switch (opcode & 0xF000) {
+		case 0x1000:
+		case 0x2000:
+		case 0x3000:
+		case 0x4000:
+		case 0x9000:
+		case 0xB000:
+			return true;
+		case 0x0000:
+			return opcode == 0x00EE;
+		case 0x5000:
+			return (opcode & 0x000F) == 0;
+		case 0xE000:
+			return true;
+		}
+		return false;
+	}
+
+	void mark(std::uint16_t address, int bytes) {
+		for (int i = 0; i < bytes; i++) {
+			std::uint16_t at = address + i;
+			code_map[at >> 3] |= 1 << (at & 7);
+		}
+	}
+
+	void plan() {
+		for (const BasicBlock& block : analysis.blocks) {
+			bool modified = false;
+			for (const MemoryRange& range : analysis.self_modifying) {
+				modified |= range.start < block.end && block.start < range.end;
+			}
+			if (modified) {
+				continue;
+			}
+			// a run starts at the block and again after anything interpreted
+			bool open = false;
+			for (std::uint16_t at = block.start; at < block.end; at += length(fetch(at))) {
+				std::uint16_t opcode = fetch(at);
+				mark(at, length(opcode));
+				if (translatable(opcode)) {
+					translated[at] = true;
+					starts[at] = !open;
+					open = true;
+				}
+				else {
+					open = false;
+				}
+			}
+		}
+		// lengths are counted back from the end of each run
+		for (int at = 65535; at >= 0; at--) {
+			if (!translated[at]) {
+				continue;
+			}
+			std::uint16_t opcode = fetch(at);
+			std::uint16_t next = at + length(opcode);
+			bool continues = !ends_run(opcode) && translated[next] && !starts[next];
+			run_length[at] = continues ? run_length[next] + 1 : 1;
+		}
+	}
+
+	bool marked(std::uint16_t address) const {
+		return code_map[address >> 3] >> (address & 7) & 1;
+	}
+
+	void emit(const std::string& line) {
+		body += line;
+		body += '\n';
+	}
+
+	// control continuing at target, straight into its code when translated
+	std::string go(std::uint16_t target) {
+		if (starts[target]) {
+			return format("goto s_%04X;", target);
+		}
+		return format("{ s.pc = 0x%04X; goto out; }", target);
+	}
+
+	std::string store(const std::string& address, const std::string& value) {
+		return "store(s, " + address + ", " + value + ", written);";
+	}
+
+	static std::string offset(int i) {
+		return i == 0 ? "s.I" : format("std::uint16_t(s.I + %d)", i);
+	}
+
+	void translate(std::uint16_t at) {
+		std::uint16_t opcode = fetch(at);
+		std::uint16_t x = (opcode & 0x0F00) >> 8;
+		std::uint16_t y = (opcode & 0x00F0) >> 4;
+		std::uint16_t kk = opcode & 0x00FF;
+		std::uint16_t n = opcode & 0x000F;
+		std::uint16_t nnn = opcode & 0x0FFF;
+		std::uint16_t next = at + length(opcode);
+		int rest = run_length[at] - 1;  // translated instructions after this one in the run
+
+		// the start of a run pays for all of it, anything else is only entered from the switch
+		if (starts[at]) {
+			emit(format("s_%04X:  // %s", at, disassemble(opcode).c_str()));
+			emit(format("\tif (left < %d) { s.pc = 0x%04X; goto out; }", run_length[at], at));
+			emit(format("\tleft -= %d;", run_length[at]));
+		}
+		else {
+			emit(format("i_%04X:  // %s", at, disassemble(opcode).c_str()));
+		}
+
+		// faults are left for the interpreter to raise
+		if (opcode == 0x00EE) {
+			emit(format("\tif (s.sp == 0) { s.pc = 0x%04X; left += 1; goto out; }", at));
+		}
+		else if ((opcode & 0xF000) == 0x2000) {
+			emit(format("\tif (s.sp == 16) { s.pc = 0x%04X; left += 1; goto out; }", at));
+		}
+		emit(format("\ts.opcode = 0x%04X;", opcode));
+
+		std::string vx = format("s.V[%d]", x);
+		std::string vy = format("s.V[%d]", y);
+		bool writes = false;
+		switch (opcode & 0xF000) {
+		case 0x0000:  // 00EE, the only one translated
+			emit("\ts.pc = s.stack[--s.sp] + 2;");
+			emit("\tgoto dispatch;");
+			uses_dispatch = true;
+			return;
+		case 0x1000:
+			if (nnn == at) {
+				// spinning here until the budget runs out ends the same as stopping now
+				emit(format("\ts.pc = 0x%04X;", at));
+				emit("\tleft = 0;");
+				emit("\tgoto out;");
+				return;
+			}
+			emit("\t" + go(nnn));
+			return;
+		case 0x2000:
+			emit(format("\ts.stack[s.sp++] = 0x%04X;", at));
+			emit("\t" + go(nnn));
+			return;
+		case 0x3000:
+			skip(at, format("%s == %d", vx.c_str(), kk));
+			return;
+		case 0x4000:
+			skip(at, format("%s != %d", vx.c_str(), kk));
+			return;
+		case 0x5000:
+			if (n == 0) {
+				skip(at, vx + " == " + vy);
+				return;
+			}
+			for (int i = 0; i <= std::abs(x - y); i++) {
+				int reg = x <= y ? x + i : x - i;
+				if (n == 2) {
+					emit("\t" + store(offset(i), format("s.V[%d]", reg)));
+				}
+				else {
+					emit(format("\ts.V[%d] = s.memory[%s];", reg, offset(i).c_str()));
+				}
+			}
+			writes = n == 2;
+			break;
+		case 0x6000:
+			emit(format("\t%s = %d;", vx.c_str(), kk));
+			break;
+		case 0x7000:
+			emit(format("\t%s += %d;", vx.c_str(), kk));
+			break;
+		case 0x8000:
+			alu(opcode, vx, vy);
+			break;
+		case 0x9000:
+			skip(at, vx + " != " + vy);
+			return;
+		case 0xA000:
+			emit(format("\ts.I = 0x%03X;", nnn));
+			break;
+		case 0xB000:
+			emit(format("\ts.pc = 0x%03X + s.V[%d];", nnn, quirk.jump_uses_vx ? x : 0));
+			emit("\tgoto dispatch;");
+			uses_dispatch = true;
+			return;
+		case 0xC000:
+			emit(format("\t%s = next_random(s) & %d;", vx.c_str(), kk));
+			break;
+		case 0xE000:
+			skip(at, format("%s(s.keys >> (%s & 0xF) & 1)", kk == 0x9E ? "" : "!", vx.c_str()));
+			return;
+		case 0xF000:
+			writes = kk == 0x33 || kk == 0x55;
+			misc(at, opcode, vx);
+			break;
+		}
+
+		if (writes) {
+			emit(format("\tif (written) { s.pc = 0x%04X; left += %d; goto out; }", next, rest));
+		}
+		if (rest == 0) {
+			emit("\t" + go(next));
+		}
+		else if (std::next(run_length.find(at))->first != next) {
+			emit(format("\tgoto i_%04X;", next));  // an instruction at an odd address sits in between
+		}
+	}
+
+	void skip(std::uint16_t at, const std::string& condition) {
+		std::uint16_t next = at + 2;
+		if (!marked(next) || !marked(next + 1)) {
+			// the next word may be rewritten, so its length is read when the skip runs
+			emit(format("\ts.pc = 0x%04X;", next));
+			emit(format("\tif (%s) {", condition.c_str()));
+			emit("\t\ts.pc += (s.memory[s.pc] == 0xF0 && s.memory[std::uint16_t(s.pc + 1)] == 0x00) ? 4 : 2;");
+			emit("\t}");
+			emit("\tgoto dispatch;");
+			uses_dispatch = true;
+			return;
+		}
+		std::uint16_t skipped = next + length(fetch(next));
+		emit(format("\tif (%s) %s", condition.c_str(), go(skipped).c_str()));
+		emit("\t" + go(next));
+	}
+
+	// the same statements execute() runs, in the same order
+	void alu(std::uint16_t opcode, const std::string& vx, const std::string& vy) {
+		const char* x = vx.c_str();
+		const char* y = vy.c_str();
+		switch (opcode & 0x000F) {
+		case 0x0:
+			emit(format("\t%s = %s;", x, y));
+			break;
+		case 0x1:
+		case 0x2:
+		case 0x3:
+			emit(format("\t%s %c= %s;", x, "|&^"[(opcode & 0x000F) - 1], y));
+			if (quirk.logic_resets_vf) {
+				emit("\ts.V[15] = 0;");
+			}
+			break;
+		case 0x4:
+			emit(format("\ts.V[15] = (%s + %s) > 0xFF;", x, y));
+			emit(format("\t%s += %s;", x, y));
+			break;
+		case 0x5:
+			emit(format("\ts.V[15] = %s > %s;", x, y));
+			emit(format("\t%s -= %s;", x, y));
+			break;
+		case 0x6:
+			if (quirk.shift_uses_vy) {
+				emit(format("\t%s = %s;", x, y));
+			}
+			emit(format("\ts.V[15] = %s & 1;", x));
+			emit(format("\t%s >>= 1;", x));
+			break;
+		case 0x7:
+			emit(format("\ts.V[15] = %s > %s;", y, x));
+			emit(format("\t%s = %s - %s;", x, y, x));
+			break;
+		case 0xE:
+			if (quirk.shift_uses_vy) {
+				emit(format("\t%s = %s;", x, y));
+			}
+			emit(format("\ts.V[15] = %s >> 7;", x));
+			emit(format("\t%s <<= 1;", x));
+			break;
+		}
+	}
+
+	void misc(std::uint16_t at, std::uint16_t opcode, const std::string& vx) {
+		int x = (opcode & 0x0F00) >> 8;
+		const char* v = vx.c_str();
+		switch (opcode & 0x00FF) {
+		case 0x00:
+			emit(format("\ts.I = 0x%04X;", fetch(at + 2)));
+			break;
+		case 0x01:
+			emit(format("\ts.planes = %d;", x & 3));
+			break;
+		case 0x07:
+			emit(format("\t%s = s.delay_timer;", v));
+			break;
+		case 0x15:
+			emit(format("\ts.delay_timer = %s;", v));
+			break;
+		case 0x18:
+			emit(format("\ts.sound_timer = %s;", v));
+			break;
+		case 0x1E:
+			if (quirk.index_overflow_sets_vf) {
+				emit(format("\ts.V[15] = (s.I + %s) > 0xFFF;", v));
+			}
+			emit(format("\ts.I += %s;", v));
+			break;
+		case 0x29:
+			emit(format("\ts.I = %s * 5;", v));
+			break;
+		case 0x30:
+			emit(format("\ts.I = 80 + (%s & 0xF) * 10;", v));
+			break;
+		case 0x33:
+			emit("\t" + store(offset(0), vx + " / 100"));
+			emit("\t" + store(offset(1), "(" + vx + " / 10) % 10"));
+			emit("\t" + store(offset(2), vx + " % 10"));
+			break;
+		case 0x3A:
+			emit(format("\ts.pitch = %s;", v));
+			break;
+		case 0x55:
+		case 0x65:
+			for (int i = 0; i <= x; i++) {
+				if ((opcode & 0x00FF) == 0x55) {
+					emit("\t" + store(offset(i), format("s.V[%d]", i)));
+				}
+				else {
+					emit(format("\ts.V[%d] = s.memory[%s];", i, offset(i).c_str()));
+				}
+			}
+			if (quirk.load_store_increments_i) {
+				emit(format("\ts.I += %d;", x + 1));
+			}
+			break;
+		case 0x75:
+		case 0x85:
+			for (int i = 0; i <= x; i++) {
+				emit((opcode & 0x00FF) == 0x75 ? format("\ts.rpl[%d] = s.V[%d];", i, i) : format("\ts.V[%d] = s.rpl[%d];", i, i));
+			}
+			break;
+		}
+	}
+
+	void write(std::FILE* out, const std::string& rom_name) {
+		std::fprintf(out, "// Generated by tools/recompile from %s for the %s quirk profile, do not edit.\n",
+			rom_name.c_str(), quirk_profile_name(quirks));
+		std::fprintf(out, "#include \"compiled.h\"\n#include <cstdint>\n\nnamespace {\n");
+
+		std::size_t used = code_map.size();
+		while (used > 0 && code_map[used - 1] == 0) {
+			used--;
+		}
+		std::fprintf(out, "const std::uint8_t code_map[8192] = {");
+		for (std::size_t i = 0; i < used; i++) {
+			std::fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n\t" : " ", code_map[i]);
+		}
+		std::fprintf(out, "\n};\n\nconst std::uint8_t image[%zu] = {", std::max<std::size_t>(rom.size(), 1));
+		for (std::size_t i = 0; i < rom.size(); i++) {
+			std::fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n\t" : " ", rom[i]);
+		}
+		std::fprintf(out, "\n};\n\n");
+
+		std::fprintf(out,
+			"// the interpreter's xorshift32, so both draw the same numbers\n"
+			"inline std::uint8_t next_random(Chip8State& s) {\n"
+			"\ts.rng ^= s.rng << 13;\n"
+			"\ts.rng ^= s.rng >> 17;\n"
+			"\ts.rng ^= s.rng << 5;\n"
+			"\treturn s.rng >> 24;\n"
+			"}\n\n"
+			"inline void store(Chip8State& s, std::uint16_t address, std::uint8_t value, bool& written) {\n"
+			"\twritten |= code_map[address >> 3] >> (address & 7) & 1;\n"
+			"\ts.memory[address] = value;\n"
+			"}\n\n"
+			"int run(Chip8State& s, int budget, bool& invalidated) {\n"
+			"\tint left = budget;\n"
+			"\tbool written = false;\n");
+		if (uses_dispatch) {
+			std::fprintf(out, "dispatch:\n");
+		}
+		std::fprintf(out, "\tswitch (s.pc) {\n");
+		for (const auto& entry : run_length) {
+			if (starts[entry.first]) {
+				std::fprintf(out, "\tcase 0x%04X: goto s_%04X;\n", entry.first, entry.first);
+			}
+			else {
+				std::fprintf(out, "\tcase 0x%04X: if (left < %d) goto out; left -= %d; goto i_%04X;\n", entry.first,
+					entry.second, entry.second, entry.first);
+			}
+		}
+		std::fprintf(out, "\tdefault: goto out;\n\t}\n%s", body.c_str());
+		std::fprintf(out, "out:\n\tinvalidated = written;\n\treturn budget - left;\n}\n\n");
+		std::fprintf(out, "const CompiledRom rom = { 0x%016llXULL, QuirkProfile::%s, code_map, image, %zu, run };\n",
+			static_cast<unsigned long long>(hash_bytes(rom.data(), rom.size())), profile_enumerators[static_cast<int>(quirks)],
+			rom.size());
+		std::fprintf(out, "CompiledRomRegistration registration(&rom);\n}\n");
+	}
+};
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::fprintf(stderr, "usage: %s <rom> <out.cpp> [quirks]\n", argv[0]);
+		return 1;
+	}
+	std::ifstream file(argv[1], std::ios::binary);
+	if (!file.is_open()) {
+		std::fprintf(stderr, "%s: could not load rom\n", argv[1]);
+		return 1;
+	}
+	Translator translator;
+	translator.rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	if (translator.rom.size() > 65536 - START) {
+		std::fprintf(stderr, "%s: too large\n", argv[1]);
+		return 1;
+	}
+	translator.analysis = analyze_rom(translator.rom.data(), translator.rom.size());
+	translator.quirks = suggest_quirk_profile(translator.analysis);
+	if (argc > 3 && !parse_quirk_profile(argv[3], translator.quirks)) {
+		std::fprintf(stderr, "%s: unknown quirk profile\n", argv[3]);
+		return 1;
+	}
+	translator.quirk = quirk_values(translator.quirks);
+
+	translator.plan();
+	for (const auto& entry : translator.run_length) {
+		translator.translate(entry.first);
+	}
+	std::FILE* out = std::fopen(argv[2], "w");
+	if (out == nullptr) {
+		std::fprintf(stderr, "%s: cannot write\n", argv[2]);
+		return 1;
+	}
+	std::string name = argv[1];
+	translator.write(out, name.substr(name.find_last_of('/') + 1));
+	std::fclose(out);
+
+	int instructions = 0;
+	for (const BasicBlock& block : translator.analysis.blocks) {
+		for (std::uint16_t at = block.start; at < block.end; at += Translator::length(translator.fetch(at))) {
+			instructions++;
+		}
+	}
+	std::printf("%zu of %d reachable instructions translated, %s quirks\n", translator.run_length.size(), instructions,
+		quirk_profile_name(translator.quirks));
+	return 0;
+}
@@ -0,0 +1,108 @@
+// Edits the per-rom settings database the emulator loads at startup.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/romdb.cpp source/romdb.cpp -o romdb
+//
+// Usage:
+//   romdb <db> list
+//   romdb <db> set <rom> [ipf=N|vip] [quirks=legacy|vip|chip48|schip|xochip]
+//                        [bg=RRGGBBAA] [fg=RRGGBBAA] [keys=0123456789ABCDEF]
+//   romdb <db> remove <rom>
+#include "hash.h"
+#include "romdb.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+bool hash_file(const char* path, std::uint64_t& hash) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		std::fprintf(stderr, "%s: cannot open rom\n", path);
+		return false;
+	}
+	std::vector<char> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	hash = hash_bytes(rom.data(), rom.size());
+	return true;
+}
+
+bool apply_option(const std::string& option, RomSettings& settings) {
+	std::size_t equals = option.find('=');
+	std::string key = option.substr(0, equals);
+	std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+	if (key == "ipf") {  // "vip" times frames by cosmac vip machine cycles
+		settings.instructions_per_frame = value == "vip" ? 0 : std::strtoul(value.c_str(), nullptr, 10);
+		return value == "vip" || settings.instructions_per_frame > 0;
+	}
+	if (key == "quirks") {
+		return parse_quirk_profile(value, settings.quirks);
+	}
+	if (key == "bg" || key == "fg") {
+		(key == "bg" ? settings.background : settings.foreground) = std::strtoul(value.c_str(), nullptr, 16);
+		return value.size() == 8;
+	}
+	if (key == "keys" && value.size() == settings.keymap.size()) {
+		for (std::size_t i = 0; i < value.size(); i++) {
+			settings.keymap[i] = std::strtoul(value.substr(i, 1).c_str(), nullptr, 16);
+		}
+		return true;
+	}
+	return false;
+}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::fprintf(stderr, "usage: %s <db> list | set <rom> [option=value]... | remove <rom>\n", argv[0]);
+		return 1;
+	}
+	RomDatabase database;
+	database.load(argv[1]);  // a missing file starts an empty database
+	std::string command = argv[2];
+
+	if (command == "list") {
+		for (int i = 0; i < database.size(); i++) {
+			const RomSettings& settings = database.settings(i);
+			std::string ipf = settings.instructions_per_frame == 0 ? "vip" : std::to_string(settings.instructions_per_frame);
+			std::printf("%016" PRIx64 " ipf=%s quirks=%s bg=%08" PRIX32 " fg=%08" PRIX32 " keys=", database.hash(i),
+				ipf.c_str(), quirk_profile_name(settings.quirks), settings.background, settings.foreground);
+			for (std::uint8_t key : settings.keymap) {
+				std::printf("%X", key);
+			}
+			std::printf("\n");
+		}
+		return 0;
+	}
+
+	std::uint64_t hash;
+	if (argc < 4 || !hash_file(argv[3], hash)) {
+		return 1;
+	}
+	if (command == "set") {
+		const RomSettings* existing = database.find(hash);
+		RomSettings settings = existing != nullptr ? *existing : RomSettings();
+		for (int i = 4; i < argc; i++) {
+			if (!apply_option(argv[i], settings)) {
+				std::fprintf(stderr, "invalid option: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		database.set(hash, settings);
+	}
+	else if (command == "remove") {
+		if (!database.remove(hash)) {
+			std::fprintf(stderr, "%s: not in the database\n", argv[3]);
+			return 1;
+		}
+	}
+	else {
+		std::fprintf(stderr, "unknown command: %s\n", command.c_str());
+		return 1;
+	}
+	return database.save(argv[1]) ? 0 : 1;
+}
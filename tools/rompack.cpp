@@ -0,0 +1,41 @@
+// Packs roms into a single RomPack file for corpus runs, or lists a pack.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/rompack.cpp source/rompack.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o rompack
+//
+// Usage:
+//   rompack <out.pack> <rom>...
+//   rompack -l <in.pack>
+#include "chip8.h"
+#include "rompack.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+	if (argc >= 3 && std::strcmp(argv[1], "-l") == 0) {
+		RomPack pack;
+		if (!pack.open(argv[2])) {
+			std::fprintf(stderr, "%s: not a valid rom pack\n", argv[2]);
+			return 1;
+		}
+		for (int i = 0; i < pack.size(); i++) {
+			std::printf("%016" PRIx64 " %5zu %s\n", pack.hash(i), pack.rom_size(i), pack.name(i).c_str());
+		}
+		return 0;
+	}
+	if (argc < 3) {
+		std::fprintf(stderr, "usage: %s <out.pack> <rom>...\n       %s -l <in.pack>\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	std::vector<std::string> roms(argv + 2, argv + argc);
+	if (!RomPack::build(argv[1], roms)) {
+		std::fprintf(stderr, "%s: could not write pack, or two roms share a name\n", argv[1]);
+		return 1;
+	}
+	std::printf("packed %zu roms into %s\n", roms.size(), argv[1]);
+	return 0;
+}
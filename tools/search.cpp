@@ -0,0 +1,354 @@
+// Searches the inputs a rom can be given for a sequence that reaches a goal,
+// for automated game testing. From the rom's power on state, every decision
+// tries each of the 16 keys held and no key for a few frames. States already
+// reached another way are dropped by a hash of everything that decides what
+// the machine does next. Each layer of decisions is expanded breadth first
+// across all cores, and the layer is cut down to a beam of the states
+// closest to the goal when it grows too wide.
+//
+// Goals:
+//   mADDR=VV   the byte at ADDR equals VV, also > and <, all hex
+//   sHASH      the display hashes to HASH, as tools/conformance prints it
+//
+// The inputs found print as a tools/conformance setup, so the run can be
+// replayed and kept as a test.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -pthread -iquote source tools/search.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o search
+//
+// Usage:
+//   search [-q quirks=rom's] [-i instructions per frame=rom's] [-w warm up frames=0] [-f frames per decision=4]
+//          [-d decisions=100] [-b beam width=2048] [-j threads] <rom> <goal>
+#include "chip8.h"
+#include "hash.h"
+#include "romdb.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+const int NO_KEY = 16;
+
+struct Goal {
+	char kind;                // 'm' memory, 's' screen
+	std::uint16_t address;
+	char relation;            // '=', '>' or '<'
+	int value;
+	std::uint64_t screen;
+
+	bool parse(const char* text) {
+		unsigned parsed_address, parsed_value;
+		kind = text[0];
+		if (kind == 'm' && std::sscanf(text, "m%x%c%x", &parsed_address, &relation, &parsed_value) == 3 &&
+			parsed_address < 65536 && parsed_value < 256 && std::strchr("=<>", relation) != nullptr) {
+			address = static_cast<std::uint16_t>(parsed_address);
+			value = static_cast<int>(parsed_value);
+			return true;
+		}
+		return kind == 's' && std::sscanf(text, "s%" SCNx64, &screen) == 1;
+	}
+
+	// 0 once reached, otherwise how far off, which orders the beam
+	int distance(const Chip8State& state) const {
+		if (kind == 's') {
+			return hash_bytes(state.graphics.data(), sizeof(state.graphics)) == screen ? 0 : 1;
+		}
+		int byte = state.memory[address];
+		switch (relation) {
+		case '>':
+			return std::max(0, value + 1 - byte);
+		case '<':
+			return std::max(0, byte - value + 1);
+		default:
+			return std::abs(byte - value);
+		}
+	}
+};
+
+// everything that decides what the machine does next; the cycle and fault
+// counters and the last opcode do not, and the keys are set afresh by every
+// decision
+std::uint64_t state_hash(const Chip8State& state) {
+	std::uint64_t hash = hash_words(state.memory.data(), state.memory.size());
+	hash = hash_words(state.graphics.data(), sizeof(state.graphics), hash);
+	hash = hash_bytes(state.stack.data(), state.sp * sizeof(state.stack[0]), hash);
+	hash = hash_bytes(state.V.data(), state.V.size(), hash);
+	hash = hash_bytes(state.rpl.data(), state.rpl.size(), hash);
+	hash = hash_bytes(state.pattern.data(), state.pattern.size(), hash);
+	std::uint8_t registers[] = {
+		state.delay_timer, state.sound_timer,
+		static_cast<std::uint8_t>(state.I), static_cast<std::uint8_t>(state.I >> 8),
+		static_cast<std::uint8_t>(state.pc), static_cast<std::uint8_t>(state.pc >> 8),
+		static_cast<std::uint8_t>(state.sp),
+		static_cast<std::uint8_t>(state.rng), static_cast<std::uint8_t>(state.rng >> 8),
+		static_cast<std::uint8_t>(state.rng >> 16), static_cast<std::uint8_t>(state.rng >> 24),
+		state.hires, state.planes, state.pitch, state.pattern_set,
+		static_cast<std::uint8_t>(state.timing_credit), static_cast<std::uint8_t>(state.timing_credit >> 8),
+		static_cast<std::uint8_t>(state.halt_reason)
+	};
+	return hash_bytes(registers, sizeof(registers), hash);
+}
+
+// hashes of every state reached, split over shards so threads inserting at
+// once rarely wait on each other
+class StateSet {
+private:
+	struct Shard {
+		std::mutex lock;
+		std::unordered_set<std::uint64_t> hashes;
+	};
+	std::array<Shard, 64> shards;
+
+public:
+	// false when the state was reached before
+	bool insert(std::uint64_t hash) {
+		Shard& shard = shards[hash >> 58];
+		std::lock_guard<std::mutex> guard(shard.lock);
+		return shard.hashes.insert(hash).second;
+	}
+
+	std::size_t size() {
+		std::size_t total = 0;
+		for (Shard& shard : shards) {
+			std::lock_guard<std::mutex> guard(shard.lock);
+			total += shard.hashes.size();
+		}
+		return total;
+	}
+};
+
+struct Step {
+	std::uint32_t parent;  // in the previous layer
+	std::uint8_t input;    // key held, NO_KEY for none
+};
+
+struct Child {
+	std::unique_ptr<Chip8State> state;
+	Step step;
+	std::uint64_t hash;
+	int distance;
+};
+
+struct Options {
+	std::string quirks;
+	int instructions = -1;  // -1 takes the rom's own, 0 runs with vip timing
+	int warm_up = 0;
+	int frames = 4;
+	int decisions = 100;
+	std::size_t beam = 2048;
+	int threads = 1;
+};
+
+std::unique_ptr<Chip8> load(const std::vector<std::uint8_t>& rom, const Options& options, int& instructions) {
+	std::unique_ptr<Chip8> chip8(new Chip8());
+	if (!chip8->load_rom(rom.data(), rom.size())) {
+		return nullptr;
+	}
+	chip8->seed(1);
+	QuirkProfile quirks;
+	if (!options.quirks.empty()) {
+		if (!parse_quirk_profile(options.quirks, quirks)) {
+			return nullptr;
+		}
+		chip8->set_quirk_profile(quirks);
+	}
+	instructions = options.instructions >= 0 ? options.instructions : chip8->get_settings().instructions_per_frame;
+	chip8->set_timing_mode(instructions == 0 ? TimingMode::CosmacVip : TimingMode::Instructions);
+	return chip8;
+}
+
+// the keys of a path as kK@A-B holds, runs of one key merged
+std::string format_setup(const std::vector<std::uint8_t>& inputs, const Options& options) {
+	std::string setup;
+	for (std::size_t i = 0; i < inputs.size();) {
+		std::size_t end = i + 1;
+		while (end < inputs.size() && inputs[end] == inputs[i]) {
+			end++;
+		}
+		if (inputs[i] != NO_KEY) {
+			char hold[32];
+			std::snprintf(hold, sizeof(hold), "%sk%X@%d-%d", setup.empty() ? "" : ",", inputs[i],
+				options.warm_up + static_cast<int>(i) * options.frames, options.warm_up + static_cast<int>(end) * options.frames);
+			setup += hold;
+		}
+		i = end;
+	}
+	return setup.empty() ? "-" : setup;
+}
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	options.threads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<const char*> arguments;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc) {
+			const char* value = argv[++i];
+			switch (arg[1]) {
+			case 'q': options.quirks = value; break;
+			case 'i': options.instructions = std::atoi(value); break;
+			case 'w': options.warm_up = std::max(0, std::atoi(value)); break;
+			case 'f': options.frames = std::max(1, std::atoi(value)); break;
+			case 'd': options.decisions = std::max(1, std::atoi(value)); break;
+			case 'b': options.beam = std::max(1, std::atoi(value)); break;
+			case 'j': options.threads = std::max(1, std::atoi(value)); break;
+			default:
+				std::fprintf(stderr, "%s: unknown option\n", arg.c_str());
+				return 1;
+			}
+			continue;
+		}
+		arguments.push_back(argv[i]);
+	}
+	Goal goal;
+	if (arguments.size() != 2 || !goal.parse(arguments[1])) {
+		std::fprintf(stderr, "usage: %s [-q quirks] [-i instructions] [-w frames] [-f frames] [-d decisions] [-b width] [-j threads] <rom> <mADDR=VV|sHASH>\n", argv[0]);
+		return 1;
+	}
+	std::ifstream file(arguments[0], std::ios::binary);
+	std::vector<std::uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	int instructions;
+	std::unique_ptr<Chip8> root = load(rom, options, instructions);
+	if (!file.is_open() || root == nullptr) {
+		std::fprintf(stderr, "%s: could not load rom, or unknown quirk profile\n", arguments[0]);
+		return 1;
+	}
+	for (int frame = 0; frame < options.warm_up; frame++) {
+		root->run_frame(instructions);
+	}
+
+	// only the layer being expanded keeps its states, earlier layers keep
+	// the steps that lead back to the root
+	std::vector<std::unique_ptr<Chip8State>> frontier;
+	frontier.emplace_back(new Chip8State());
+	root->save_state(*frontier.back());
+	std::vector<std::vector<Step>> layers;
+	StateSet seen;
+	seen.insert(state_hash(*frontier.back()));
+	if (goal.distance(*frontier.back()) == 0) {
+		std::printf("goal reached at power on%s\n", options.warm_up > 0 ? " and warm up" : "");
+		return 0;
+	}
+
+	// one machine per worker, loaded with the rom so its settings and idle
+	// loops match, states are swapped in and out with load/save_state
+	std::vector<std::unique_ptr<Chip8>> machines;
+	std::vector<std::unique_ptr<Chip8State>> scratch;
+	for (int i = 0; i < options.threads; i++) {
+		int ignored;
+		machines.push_back(load(rom, options, ignored));
+		scratch.emplace_back(new Chip8State());
+	}
+
+	std::atomic<std::uint64_t> expanded(0);
+	std::atomic<bool> found(false);
+	std::mutex found_lock;
+	Step found_step = { 0, NO_KEY };
+	auto begin = std::chrono::steady_clock::now();
+	for (int decision = 0; decision < options.decisions && !frontier.empty() && !found; decision++) {
+		std::vector<std::vector<Child>> produced(options.threads);
+		std::atomic<std::size_t> next(0);
+		auto expand = [&](int worker) {
+			Chip8& chip8 = *machines[worker];
+			Chip8State& state = *scratch[worker];
+			for (std::size_t i = next++; i < frontier.size() && !found; i = next++) {
+				// no key first, so a rom that ignores input gets an empty setup
+				for (int choice = 0; choice <= NO_KEY; choice++) {
+					int input = (choice + NO_KEY) % (NO_KEY + 1);
+					chip8.load_state(*frontier[i]);
+					for (int key = 0; key < 16; key++) {
+						chip8.release_key(key);
+					}
+					if (input != NO_KEY) {
+						chip8.press_key(input);
+					}
+					for (int frame = 0; frame < options.frames; frame++) {
+						chip8.run_frame(instructions);
+					}
+					chip8.save_state(state);
+					expanded++;
+					std::uint64_t hash = state_hash(state);
+					if (!seen.insert(hash)) {
+						continue;
+					}
+					Step step = { static_cast<std::uint32_t>(i), static_cast<std::uint8_t>(input) };
+					int distance = goal.distance(state);
+					if (distance == 0) {
+						std::lock_guard<std::mutex> guard(found_lock);
+						if (!found) {
+							found_step = step;
+							found = true;
+						}
+						return;
+					}
+					produced[worker].push_back({ std::unique_ptr<Chip8State>(new Chip8State(state)), step, hash, distance });
+				}
+			}
+		};
+		std::vector<std::thread> workers;
+		for (int i = 0; i < options.threads; i++) {
+			workers.emplace_back(expand, i);
+		}
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		if (found) {
+			break;
+		}
+
+		std::vector<Child> children;
+		for (std::vector<Child>& part : produced) {
+			std::move(part.begin(), part.end(), std::back_inserter(children));
+		}
+		std::size_t reached = children.size();
+		if (children.size() > options.beam) {
+			// closest first, the hash breaks ties so the cut does not depend
+			// on which thread got there first
+			std::sort(children.begin(), children.end(), [](const Child& a, const Child& b) {
+				return a.distance != b.distance ? a.distance < b.distance : a.hash < b.hash;
+			});
+			children.resize(options.beam);
+		}
+		frontier.clear();
+		layers.emplace_back();
+		for (Child& child : children) {
+			frontier.push_back(std::move(child.state));
+			layers.back().push_back(child.step);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		std::printf("decision %d: %zu new states, %zu kept, %.0f states/s\n", decision + 1, reached, frontier.size(),
+			expanded / seconds);
+		std::fflush(stdout);
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	std::printf("%llu states expanded, %zu distinct, in %.2f s, %.0f states/s on %d threads\n",
+		static_cast<unsigned long long>(expanded), seen.size(), seconds, expanded / seconds, options.threads);
+	if (!found) {
+		std::printf("goal not reached\n");
+		return 1;
+	}
+	std::vector<std::uint8_t> inputs(1, found_step.input);
+	for (std::uint32_t at = found_step.parent, layer = static_cast<std::uint32_t>(layers.size()); layer > 0; layer--) {
+		inputs.push_back(layers[layer - 1][at].input);
+		at = layers[layer - 1][at].parent;
+	}
+	std::reverse(inputs.begin(), inputs.end());
+	std::printf("goal reached after %zu decisions, %d frames\n", inputs.size(), options.warm_up + static_cast<int>(inputs.size()) * options.frames);
+	std::printf("setup %s\n", format_setup(inputs, options).c_str());
+	return 0;
+}
@@ -0,0 +1,152 @@
+// Runs thousands of sessions of one rom through a Scheduler while a bot
+// thread presses keys on random sessions, the way a bot farm or replay
+// server would, and reports how many sessions were parked waiting for
+// input or a timer and how many could be served at 60 frames a second.
+// Then runs the same sessions the plain way, every machine every frame, for
+// comparison.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -pthread -iquote source tools/sessions.cpp source/scheduler.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o sessions
+//
+// Usage:
+//   sessions <rom> [sessions=10000] [ticks=600] [threads=all] [key presses per session per second=0.5]
+#include "chip8.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+// a press on a random session every so often and its release a tick later,
+// paced by the tick counter so both runs see the same input
+void press_keys(std::atomic<int>& ticks, int total, int sessions, double rate, std::atomic<bool>& stop,
+	const std::function<void(int, int, bool)>& post) {
+	std::mt19937 random(1);
+	double per_tick = sessions * rate / 60;
+	std::vector<std::pair<int, int>> held;
+	for (int tick = 0; tick < total && !stop;) {
+		if (ticks.load() < tick) {
+			std::this_thread::yield();
+			continue;
+		}
+		for (const std::pair<int, int>& press : held) {
+			post(press.first, press.second, false);
+		}
+		held.clear();
+		for (double left = per_tick; left > 0; left--) {
+			if (left < 1 && std::generate_canonical<double, 32>(random) > left) {
+				break;
+			}
+			std::pair<int, int> press(random() % sessions, random() % 16);
+			post(press.first, press.second, true);
+			held.push_back(press);
+		}
+		tick++;
+	}
+}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s <rom> [sessions] [ticks] [threads] [presses per second]\n", argv[0]);
+		return 1;
+	}
+	std::ifstream file(argv[1], std::ios::binary);
+	std::vector<std::uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	std::unique_ptr<Chip8> reference(new Chip8());
+	std::unique_ptr<SharedRom> shared(new SharedRom());
+	if (!file.is_open() || !reference->load_rom(rom.data(), rom.size()) || !shared->load(rom.data(), rom.size())) {
+		std::fprintf(stderr, "%s: could not load rom\n", argv[1]);
+		return 1;
+	}
+	int count = argc > 2 ? std::max(1, std::atoi(argv[2])) : 10000;
+	int total = argc > 3 ? std::max(1, std::atoi(argv[3])) : 600;
+	int threads = argc > 4 ? std::max(1, std::atoi(argv[4])) : std::max(1u, std::thread::hardware_concurrency());
+	double rate = argc > 5 ? std::atof(argv[5]) : 0.5;
+	int instructions = reference->get_settings().instructions_per_frame;
+
+	auto make_machines = [&]() {
+		std::vector<std::unique_ptr<Chip8>> machines;
+		for (int i = 0; i < count; i++) {
+			machines.emplace_back(new Chip8(*shared));
+		}
+		return machines;
+	};
+
+	// scheduled: stalled machines are parked until a key reaches them
+	std::vector<std::unique_ptr<Chip8>> machines = make_machines();
+	std::unique_ptr<Scheduler> scheduler(new Scheduler(threads));
+	for (std::unique_ptr<Chip8>& machine : machines) {
+		scheduler->add(machine.get(), instructions);
+	}
+	std::atomic<int> ticks(0);
+	std::atomic<bool> stop(false);
+	std::thread bot(press_keys, std::ref(ticks), total, count, rate, std::ref(stop),
+		[&](int session, int key, bool pressed) { scheduler->post_key(session, key, pressed); });
+	double parked = 0;
+	auto begin = std::chrono::steady_clock::now();
+	for (int tick = 0; tick < total; tick++) {
+		scheduler->tick();
+		parked += scheduler->get_parked();
+		ticks = tick + 1;
+	}
+	double scheduled = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	stop = true;
+	bot.join();
+	std::uint64_t frames = 0;
+	for (int i = 0; i < count; i++) {
+		frames += scheduler->get_frames(i);
+	}
+	std::printf("scheduled: %.3f s, %llu frames run, %.1f%% of sessions parked on average, %.0f sessions at 60 fps\n",
+		scheduled, static_cast<unsigned long long>(frames), 100 * parked / total / count, count * total / scheduled / 60);
+
+	// every machine every frame on the same threads, keys applied in between
+	machines = make_machines();
+	std::vector<std::vector<KeyEvent>> inboxes(count);
+	std::mutex inbox_lock;
+	ticks = 0;
+	stop = false;
+	bot = std::thread(press_keys, std::ref(ticks), total, count, rate, std::ref(stop),
+		[&](int session, int key, bool pressed) {
+			std::lock_guard<std::mutex> guard(inbox_lock);
+			inboxes[session].push_back(KeyEvent{ 0, static_cast<std::uint8_t>(key), pressed });
+		});
+	begin = std::chrono::steady_clock::now();
+	for (int tick = 0; tick < total; tick++) {
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++) {
+			workers.emplace_back([&, t]() {
+				std::vector<KeyEvent> events;
+				for (int i = t; i < count; i += threads) {
+					{
+						std::lock_guard<std::mutex> guard(inbox_lock);
+						events.swap(inboxes[i]);
+					}
+					machines[i]->run_frame(instructions, events.data(), static_cast<int>(events.size()));
+					events.clear();
+				}
+			});
+		}
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		ticks = tick + 1;
+	}
+	double plain = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	stop = true;
+	bot.join();
+	std::printf("plain:     %.3f s, %llu frames run, %.0f sessions at 60 fps, scheduled is %.2fx\n", plain,
+		static_cast<unsigned long long>(count) * total, count * total / plain / 60, plain / scheduled);
+	return 0;
+}
@@ -0,0 +1,59 @@
+// Decodes a binary instruction trace written by Tracer, from the frontend's
+// trace toggle or a crash, into one disassembled line per instruction,
+// oldest first.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/tracedump.cpp source/analyzer.cpp -o tracedump
+//
+// Usage:
+//   tracedump <trace> [last=all]
+#include "analyzer.h"
+#include "tracer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s <trace> [last]\n", argv[0]);
+		return 1;
+	}
+	std::FILE* file = std::fopen(argv[1], "rb");
+	if (file == nullptr) {
+		std::fprintf(stderr, "%s: cannot open trace\n", argv[1]);
+		return 1;
+	}
+	TraceHeader header;
+	if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, "C8TR", 4) != 0 ||
+		header.version != TRACE_VERSION) {
+		std::fprintf(stderr, "%s: not a version %u trace\n", argv[1], TRACE_VERSION);
+		std::fclose(file);
+		return 1;
+	}
+	std::vector<TraceEntry> entries(header.count);
+	std::size_t count = std::fread(entries.data(), sizeof(TraceEntry), entries.size(), file);
+	std::fclose(file);
+	if (count != entries.size()) {
+		std::fprintf(stderr, "%s: truncated, %zu of %u entries\n", argv[1], count, header.count);
+	}
+
+	std::size_t last = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : count;
+	std::size_t first = last < count ? count - last : 0;
+	std::printf("rom %016llx, %llu instructions traced, showing %zu\n", static_cast<unsigned long long>(header.rom_hash),
+		static_cast<unsigned long long>(header.executed), count - first);
+
+	// numbered from when tracing started, counting the oldest lines lost to the ring
+	std::uint64_t base = header.executed - header.count;
+	for (std::size_t i = first; i < count; i++) {
+		const TraceEntry& entry = entries[i];
+		std::uint8_t reg = Tracer::written_register(entry.opcode);
+		char written[8] = "";
+		if (reg != NO_REGISTER) {
+			std::snprintf(written, sizeof(written), "V%X=%02X", reg, reg == 0xF ? entry.vf : entry.vx);
+		}
+		std::printf("%10llu  %03X  %04X  %-18s I=%03X  %s\n", static_cast<unsigned long long>(base + i + 1), entry.pc,
+			entry.opcode, disassemble(entry.opcode).c_str(), entry.I, written);
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+// Times one Chip8 running a rom at the high instruction rates xo-chip demos
+// use, and splits each frame into emulation, converting the two bitplanes
+// to RGBA as the frontend's present() does, and a run-ahead snapshot save
+// and restore, so each can be compared against the 16.7 ms frame budget.
+//
+// Build on the host with:
+//   g++ -O2 -std=gnu++17 -iquote source tools/xo_bench.cpp source/chip8.cpp source/romdb.cpp source/analyzer.cpp source/profiler.cpp source/tracer.cpp source/debugger.cpp -o xo_bench
+//
+// Usage:
+//   xo_bench <rom> [instructions per frame=10000] [frames=600] [quirks=xochip]
+#include "chip8.h"
+#include "romdb.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double microseconds(Clock::time_point begin, Clock::time_point end) {
+	return std::chrono::duration<double, std::micro>(end - begin).count();
+}
+
+// the same loop present() runs over the texture
+void convert(Chip8& chip8, std::vector<std::uint32_t>& pixels) {
+	static const std::uint32_t palette[4] = { 0x000000FF, 0xFFFFFFFF, 0xFF6600FF, 0x662200FF };
+	int width = chip8.get_width();
+	for (int y = 0; y < chip8.get_height(); y++) {
+		const std::uint64_t* row = chip8.get_row(y);
+		std::uint32_t* out = pixels.data() + y * 128;
+		for (int x = 0; x < width; x++) {
+			int shift = 63 - x % 64;
+			out[x] = palette[(row[x / 64] >> shift & 1) | (row[2 + x / 64] >> shift & 1) << 1];
+		}
+	}
+}
+
+struct Timing {
+	double total = 0;
+	double worst = 0;
+
+	void add(double us) {
+		total += us;
+		worst = std::max(worst, us);
+	}
+};
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s <rom> [instructions per frame] [frames] [quirks]\n", argv[0]);
+		return 1;
+	}
+	int instructions = argc > 2 ? std::atoi(argv[2]) : 10000;
+	int frames = argc > 3 ? std::atoi(argv[3]) : 600;
+	QuirkProfile quirks = QuirkProfile::XoChip;
+	if (argc > 4 && !parse_quirk_profile(argv[4], quirks)) {
+		std::fprintf(stderr, "%s: unknown quirk profile\n", argv[4]);
+		return 1;
+	}
+
+	std::ifstream file(argv[1], std::ios::binary);
+	std::vector<std::uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	std::unique_ptr<Chip8> chip8(new Chip8());
+	if (!file.is_open() || !chip8->load_rom(rom.data(), rom.size())) {
+		std::fprintf(stderr, "%s: could not load rom\n", argv[1]);
+		return 1;
+	}
+	chip8->set_quirk_profile(quirks);
+
+	std::unique_ptr<Chip8State> snapshot(new Chip8State());
+	std::vector<std::uint32_t> pixels(128 * 64);
+	Timing emulate, present, rollback;
+	for (int frame = 0; frame < frames; frame++) {
+		Clock::time_point begin = Clock::now();
+		chip8->run_frame(instructions);
+		Clock::time_point ran = Clock::now();
+		convert(*chip8, pixels);
+		Clock::time_point converted = Clock::now();
+		chip8->save_state(*snapshot);
+		chip8->load_state(*snapshot);
+		Clock::time_point restored = Clock::now();
+		emulate.add(microseconds(begin, ran));
+		present.add(microseconds(ran, converted));
+		rollback.add(microseconds(converted, restored));
+	}
+
+	std::printf("%d frames at %d instructions per frame, %.2f Minstr/s\n", frames, instructions,
+		double(frames) * instructions / emulate.total);
+	std::printf("%-9s %9s %9s\n", "us/frame", "average", "worst");
+	std::printf("%-9s %9.1f %9.1f\n", "emulate", emulate.total / frames, emulate.worst);
+	std::printf("%-9s %9.1f %9.1f\n", "present", present.total / frames, present.worst);
+	std::printf("%-9s %9.1f %9.1f\n", "snapshot", rollback.total / frames, rollback.worst);
+	std::printf("budget    %9.1f\n", 1000000.0 / 60);
+	return 0;
+}